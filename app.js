@@ -70,6 +70,22 @@ const EMPTY_ARRAY = Object.freeze([]);
 const EMPTY_BUFFER = Buffer.alloc(0);
 const SINCE_STARTUP = performance.now();
 
+// Shared dictionary compression (RFC 9842): dictionary-compressed bodies start with a magic number and the SHA-256 of the dictionary
+const DCB_MAGIC = Buffer.from([0xff, 0x44, 0x43, 0x42]);
+const DCZ_MAGIC = Buffer.from([0x5e, 0x2a, 0x4d, 0x18, 0x20, 0x00, 0x00, 0x00]);
+
+// Whether a Node compressor honors the dictionary option (older versions silently ignore it)
+function supportsDictionary(compress) {
+    if (typeof compress !== "function") return false;
+
+    try {
+        const sample = crypto.randomBytes(1024);
+        return compress(sample, { dictionary: sample }).length < 256;
+    } catch {
+        return false;
+    }
+}
+
 const IS_NODE_INSPECTOR_ENABLED = !!process.execArgv.find(arg => arg.startsWith("--inspect"));
 let JWT_KEY = process.env.AKENO_KEY;
 
@@ -619,9 +635,44 @@ const backend = {
             "BROTLI",
             "JS",
             "CSS",
-            "JSON"
+            "JSON",
+            "ZSTD",
+            "DCB",
+            "DCZ"
         ]),
 
+        // zstd is only available in newer Node versions
+        zstdSupported: typeof zlib.zstdCompress === "function",
+
+        // Compression with a shared dictionary (dcb/dcz)
+        dictionarySupported: {
+            brotli: supportsDictionary(zlib.brotliCompressSync),
+            zstd: supportsDictionary(zlib.zstdCompressSync)
+        },
+
+        // Compression levels, overriden by the config
+        levels: {
+            gzip: 6,
+            brotli: 5,
+            zstd: 3
+        },
+
+        // Variants compressed in the background as soon as content is loaded (see FileServer.precompress)
+        precompressed: [],
+
+        // Content-Encoding header for each format
+        encoding(format) {
+            switch (format) {
+                case backend.compression.format.GZIP: return "gzip";
+                case backend.compression.format.DEFLATE: return "deflate";
+                case backend.compression.format.BROTLI: return "br";
+                case backend.compression.format.ZSTD: return "zstd";
+                case backend.compression.format.DCB: return "dcb";
+                case backend.compression.format.DCZ: return "dcz";
+                default: return null;
+            }
+        },
+
         compress(buffer, format = 0) {
             if(!(buffer instanceof Buffer)) {
                 buffer = Buffer.from(buffer);
@@ -645,24 +696,103 @@ const backend = {
 
             switch (format) {
                 case backend.compression.format.GZIP:
-                    return zlib.gzipSync(buffer, { level: 6 });
+                    return zlib.gzipSync(buffer, backend.compression.options(format, buffer));
 
                 case backend.compression.format.DEFLATE:
-                    return zlib.deflateSync(buffer, { level: 6 });
+                    return zlib.deflateSync(buffer, backend.compression.options(format, buffer));
 
                 case backend.compression.format.BROTLI:
-                    return zlib.brotliCompressSync(buffer, {
-                        params: {
-                            [zlib.constants.BROTLI_PARAM_QUALITY]: 5,
-                            [zlib.constants.BROTLI_PARAM_MODE]: zlib.constants.BROTLI_MODE_TEXT
-                        }
-                    });
+                    return zlib.brotliCompressSync(buffer, backend.compression.options(format, buffer));
+
+                case backend.compression.format.ZSTD:
+                    if(!backend.compression.zstdSupported) throw new Error("zstd compression is not supported by this Node version");
+                    return zlib.zstdCompressSync(buffer, backend.compression.options(format, buffer));
 
                 default:
                     throw new Error(`Unknown compression format: ${format}`);
             }
         },
 
+        // Same as compress, but runs on the libuv thread pool
+        compressAsync(buffer, format, level = null) {
+            return new Promise((resolve, reject) => {
+                const callback = (error, result) => error? reject(error): resolve(result);
+                const options = backend.compression.options(format, buffer, level);
+
+                switch (format) {
+                    case backend.compression.format.GZIP:
+                        return zlib.gzip(buffer, options, callback);
+
+                    case backend.compression.format.DEFLATE:
+                        return zlib.deflate(buffer, options, callback);
+
+                    case backend.compression.format.BROTLI:
+                        return zlib.brotliCompress(buffer, options, callback);
+
+                    case backend.compression.format.ZSTD:
+                        if(!backend.compression.zstdSupported) return reject(new Error("zstd compression is not supported by this Node version"));
+                        return zlib.zstdCompress(buffer, options, callback);
+
+                    default:
+                        reject(new Error(`Unknown compression format: ${format}`));
+                }
+            });
+        },
+
+        /**
+         * Compress with a shared dictionary (format DCB or DCZ), on the libuv thread pool.
+         * @param {Buffer} buffer - The data to compress.
+         * @param {number} format - DCB (brotli) or DCZ (zstd).
+         * @param {object} dictionary - { buffer, sha256 } of the dictionary the client has.
+         */
+        compressWithDictionary(buffer, format, dictionary) {
+            return new Promise((resolve, reject) => {
+                const isBrotli = format === backend.compression.format.DCB;
+
+                if (isBrotli? !backend.compression.dictionarySupported.brotli: (format !== backend.compression.format.DCZ || !backend.compression.dictionarySupported.zstd)) {
+                    return reject(new Error(`Dictionary compression is not supported for format: ${format}`));
+                }
+
+                const options = {
+                    ...backend.compression.options(isBrotli? backend.compression.format.BROTLI: backend.compression.format.ZSTD, buffer),
+                    dictionary: dictionary.buffer
+                };
+
+                const callback = (error, result) => error? reject(error): resolve(Buffer.concat([isBrotli? DCB_MAGIC: DCZ_MAGIC, dictionary.sha256, result]));
+
+                if (isBrotli) {
+                    zlib.brotliCompress(buffer, options, callback);
+                } else {
+                    zlib.zstdCompress(buffer, options, callback);
+                }
+            });
+        },
+
+        options(format, buffer, level = null) {
+            const levels = backend.compression.levels;
+
+            switch (format) {
+                case backend.compression.format.GZIP: case backend.compression.format.DEFLATE:
+                    return { level: level ?? levels.gzip };
+
+                case backend.compression.format.BROTLI:
+                    return {
+                        params: {
+                            [zlib.constants.BROTLI_PARAM_QUALITY]: level ?? levels.brotli,
+                            [zlib.constants.BROTLI_PARAM_MODE]: zlib.constants.BROTLI_MODE_TEXT,
+                            [zlib.constants.BROTLI_PARAM_SIZE_HINT]: buffer.length
+                        }
+                    };
+
+                case backend.compression.format.ZSTD:
+                    return {
+                        params: {
+                            [zlib.constants.ZSTD_c_compressionLevel]: level ?? levels.zstd
+                        }
+                    };
+            }
+        },
+
         // Code compression with both disk and memory cache.
         code(data, format){
             // Sadly no Buffer support yet :(
@@ -924,6 +1054,15 @@ const backend = {
         backend.compression.enabled = backend.config.getBlock("web").get("compress", Boolean, true);
         backend.compression.codeEnabled = backend.config.getBlock("web").get("compress-code", Boolean, true);
 
+        backend.compression.levels.gzip = backend.config.getBlock("web").get("gzip-level", Number, 6);
+        backend.compression.levels.brotli = backend.config.getBlock("web").get("brotli-quality", Number, 5);
+        backend.compression.levels.zstd = backend.config.getBlock("web").get("zstd-level", Number, 3);
+
+        // Formats to compress in the background, eg. precompress: br, gzip, zstd; (none to disable)
+        backend.compression.precompressed = backend.config.getBlock("web").get("precompress", Array, ["br", "gzip"])
+            .map(name => name === "br"? backend.compression.format.BROTLI: backend.compression.format[String(name).toUpperCase()])
+            .filter(format => format === backend.compression.format.GZIP || format === backend.compression.format.BROTLI || format === backend.compression.format.DEFLATE || (format === backend.compression.format.ZSTD && backend.compression.zstdSupported));
+
         backend.esbuildEnabled = backend.config.getBlock("web").get("esbuild", Boolean, false);
         backend.esbuildTargets = backend.config.getBlock("web").get("esbuild-targets", Array, ["chrome58", "firefox57", "safari11"]);
     },
@@ -9,6 +9,7 @@ const fs = require("node:fs");
 const Units = require("./unit");
 
 const uws = require("uWebSockets.js");
+const crypto = require("node:crypto");
 const { xxh32, xxh64, xxh3 } = require("@node-rs/xxhash");
 
 let sharp;
@@ -283,12 +284,31 @@ class CacheManager extends Units.Server {
 
         cache[0][8] = Date.now();
 
+        // The client already has this version (req.ifNoneMatch has to be read before any await)
+        if (!status && !needsUpdate && req.ifNoneMatch && cache[0][1].ETag && backend.helper.matchesETag(req.ifNoneMatch, cache[0][1].ETag)) {
+            backend.helper.sendNotModified(req, res, cache[0][1]);
+            return;
+        }
+
         // If it's cached compressed already and no refresh
         if (!needsUpdate && cache[algo]) {
             backend.helper.send(req, res, cache[algo][0], cache[algo][1], status);
             return;
         }
 
+        // The client has the shared dictionary of this content (see FileServer.precompress)
+        const dictionaryAlgo = needsUpdate? null: backend.helper.getDictionaryCompression(req, cache[0][12]);
+        if (dictionaryAlgo && cache[dictionaryAlgo]) {
+            backend.helper.send(req, res, cache[dictionaryAlgo][0], cache[dictionaryAlgo][1], status);
+            return;
+        }
+
+        // Still being compressed in the background - send it as is rather than compressing it again here
+        if (!needsUpdate && cache[0][11] && cache[0][11].has(algo)) {
+            backend.helper.send(req, res, cache[0][0], cache[0][1], status);
+            return;
+        }
+
         // Recompress & send
         const [usedAlgo, buffer, headers] = backend.helper.sendCompressed(req, res, cache[0][0], mimeType, { ...cache[0][1] }, status, algo);
 
@@ -486,9 +506,34 @@ class FileServer extends CacheManager {
 
     /**
      * Check if more than a threshold has elapsed or mtime increased.
+     * Files tracked by the native watcher are checked without touching the filesystem.
      */
     needsUpdate(resolvedPath, fileEntry) {
         const now = Date.now();
+
+        if (fileEntry[0][9] !== undefined) {
+            const watcher = backend.native.watcher;
+
+            // Nothing changed anywhere since the last check
+            const generation = watcher.generation();
+            if (generation === fileEntry[0][10]) {
+                return false;
+            }
+
+            fileEntry[0][10] = generation;
+
+            const version = watcher.version(resolvedPath);
+            if (version !== fileEntry[0][9]
+                || (typeof fileEntry[0][4] === 'function'
+                    && fileEntry[0][4](resolvedPath) === true)) {
+                fileEntry[0][2] = now;
+                fileEntry[0][9] = version;
+                return true;
+            }
+
+            return false;
+        }
+
         const minCheckInterval = backend.mode === backend.modes.DEVELOPMENT ? 1000 : 30000;
         if (now - fileEntry[0][2] < minCheckInterval) {
             return false;
@@ -564,7 +609,9 @@ class FileServer extends CacheManager {
         // store core
         file[0][0] = content;
         file[0][1] = headers || file[0][1] || {};
-        file[0][1].ETag = `"${stats.mtimeMs.toString(36)}"`;
+        // Strong ETag from the content (the parser already hashed its output natively)
+        const digest = content?.digest || ((content instanceof Buffer || typeof content === 'string') ? backend.helper.hash(content, 'xxh128') : null);
+        file[0][1].ETag = digest ? `"${digest}"` : `"${stats.mtimeMs.toString(36)}"`;
         if (!file[0][1]['Cache-Control']) {
             file[0][1]['Cache-Control'] =
                 'public, max-age=' +
@@ -584,9 +631,78 @@ class FileServer extends CacheManager {
         file[0][6] = mimeType;       // mimeType
         file[0][7] = resolvedPath;       // store the actual key
         file[0][8] = now;            // lastAccessed
+
+        // Shared compression dictionary (eg. the template of a page), advertised so clients can fetch it
+        const dictionary = content?.dictionary || undefined;
+        file[0][12] = dictionary;    // dictionary
+        if (dictionary) {
+            file[0][1].Link = `<${dictionary.url}>; rel="compression-dictionary"`;
+            if (!file[0][1].Vary) file[0][1].Vary = 'Available-Dictionary';
+            else if (!file[0][1].Vary.includes('Available-Dictionary')) file[0][1].Vary += ', Available-Dictionary';
+        } else {
+            delete file[0][1].Link;
+        }
+
+        // Let the native watcher track changes instead of polling with stat
+        const watcher = backend.native?.watcher;
+        if (watcher?.active) {
+            const generation = watcher.generation();
+            const version = watcher.watch(resolvedPath);
+            file[0][9] = version === -1 ? undefined : version;   // watcher version
+            file[0][10] = generation;                              // watcher generation
+        }
+
+        this.precompress(file);
         return true;
     }
 
+    /**
+     * Compress a freshly loaded entry into every configured variant on the libuv thread pool, so requests find them ready.
+     * Until a variant is done, requests for it get the uncompressed content instead of compressing it themselves.
+     * Entries with a shared dictionary (file[0][12]) also get dictionary-compressed variants (dcb/dcz), if supported.
+     * Strings (js/css) are left alone, they are minified before compression on their first request.
+     */
+    precompress(file) {
+        const content = file[0][0];
+        file[0][11] = undefined;
+
+        if (!this.enableCompression || !backend.compression.enabled) return;
+        if (!(content instanceof Buffer) || content.length < backend.constants.MIN_COMPRESSION_SIZE) return;
+        if (doNotCompress.some(type => file[0][6].startsWith(type))) return;
+
+        const variants = [...backend.compression.precompressed];
+
+        // Dictionary variants, for clients that already have the dictionary
+        const dictionary = file[0][12];
+        if (dictionary) {
+            if (backend.compression.dictionarySupported.brotli) variants.push(backend.compression.format.DCB);
+            if (backend.compression.dictionarySupported.zstd) variants.push(backend.compression.format.DCZ);
+        }
+
+        if (!variants.length) return;
+
+        const pending = new Set(variants);
+        file[0][11] = pending;                                     // variants being compressed
+
+        for (const algo of variants) {
+            const compressed = algo === backend.compression.format.DCB || algo === backend.compression.format.DCZ
+                ? backend.compression.compressWithDictionary(content, algo, dictionary)
+                : backend.compression.compressAsync(content, algo);
+
+            compressed.then(buffer => {
+                // The entry was refreshed meanwhile
+                if (file[0][0] !== content) return;
+
+                file[algo] = [buffer, backend.helper.encodedHeaders({ ...file[0][1] }, algo)];
+            }).catch(error => {
+                console.error('Error precompressing file:', error);
+            }).finally(() => {
+                pending.delete(algo);
+                if (file[0][11] === pending && pending.size === 0) file[0][11] = undefined;
+            });
+        }
+    }
+
     /**
      * Add a file to cache by pathname.
      * (resolves via this.resolvePath before delegating)
@@ -657,6 +773,26 @@ module.exports = {
     ContentProcessor,
     TRANSPILE_EXTENSIONS,
 
+    /**
+     * Hashes data natively. xxh3 (64-bit), xxh128, xxh64 and xxh32 give the same hex strings as @node-rs/xxhash,
+     * which is used instead with native builds that don't export hash. Anything else falls back to md5.
+     * @param {Buffer|string} data - The data to hash.
+     * @param {string} [algorithm="xxh3"] - The hash algorithm.
+     * @returns {string} The hash as a hex string.
+     */
+    hash(data, algorithm = "xxh3"){
+        if(algorithm === "xxh3" || algorithm === "xxh128" || algorithm === "xxh64" || algorithm === "xxh32") {
+            if(backend.native.hash) return backend.native.hash(data, algorithm);
+
+            if(algorithm === "xxh3") return xxh3.xxh64(data).toString(16);
+            if(algorithm === "xxh128") return xxh3.xxh128(data).toString(16);
+            if(algorithm === "xxh64") return xxh64(data).toString(16);
+            return xxh32(data).toString(16);
+        }
+
+        return crypto.createHash('md5').update(data).digest('hex');
+    },
+
     /**
      * Returns the path segments of the request.
      * @param {object} req - The request object.
@@ -771,6 +907,72 @@ module.exports = {
         });
     },
 
+    /**
+     * Sets Content-Encoding for a compressed variant.
+     * Each encoding is a different representation, so it also gets its own strong ETag.
+     * @param {object} headers - Headers of the uncompressed content, modified in place.
+     * @param {number} algorithm - The compression format.
+     * @returns {object} The headers.
+     */
+    encodedHeaders(headers, algorithm){
+        headers["Content-Encoding"] = backend.compression.encoding(algorithm);
+        if(headers.ETag) headers.ETag = headers.ETag.slice(0, -1) + "-" + headers["Content-Encoding"] + '"';
+        return headers;
+    },
+
+    /**
+     * Picks a shared dictionary compression format, if the client advertised the given dictionary (req.availableDictionary and req.acceptEncoding have to be read before any await).
+     * @param {object} req - The request object.
+     * @param {object} dictionary - The dictionary of the content ({ hash }), if any.
+     * @returns {number|null} DCB, DCZ or null.
+     */
+    getDictionaryCompression(req, dictionary){
+        if(!dictionary || !req.availableDictionary || req.availableDictionary.trim() !== dictionary.hash) return null;
+
+        const enc = req.acceptEncoding || "";
+        if(enc.includes("dcb") && backend.compression.dictionarySupported.brotli) return backend.compression.format.DCB;
+        if(enc.includes("dcz") && backend.compression.dictionarySupported.zstd) return backend.compression.format.DCZ;
+        return null;
+    },
+
+    /**
+     * Checks an If-None-Match header against an ETag, including its compressed variants ("etag-br", "etag-gzip", ...).
+     * @param {string} ifNoneMatch - The If-None-Match header.
+     * @param {string} etag - The ETag of the uncompressed content.
+     * @returns {boolean} Whether the client already has the content.
+     */
+    matchesETag(ifNoneMatch, etag){
+        if(ifNoneMatch === "*") return true;
+
+        const base = etag.slice(0, -1);
+        for(let tag of ifNoneMatch.split(",")) {
+            tag = tag.trim();
+            if(tag.startsWith("W/")) tag = tag.slice(2);
+
+            if(tag === etag || (tag.startsWith(base) && tag.charCodeAt(base.length) === 45 && tag.endsWith('"'))) return true;
+        }
+
+        return false;
+    },
+
+    /**
+     * Sends a 304 Not Modified response, without a body.
+     * @param {object} req - The request object.
+     * @param {object} res - The response object.
+     * @param {object} headers - Headers of the cached content (ETag, Cache-Control and Vary are sent).
+     */
+    sendNotModified(req, res, headers){
+        if(req.abort) return;
+
+        res.cork(() => {
+            res.writeStatus("304 Not Modified");
+            if(headers.ETag) res.writeHeader("ETag", headers.ETag);
+            if(headers["Cache-Control"]) res.writeHeader("Cache-Control", headers["Cache-Control"]);
+            if(headers.Vary) res.writeHeader("Vary", headers.Vary);
+            res.endWithoutBody();
+        });
+    },
+
     errorPageBuffers: [
         Buffer.from(`<!DOCTYPE html><html><meta name="viewport" content="width=device-width, initial-scale=1.0"><style>body{font-family:-apple-system,BlinkMacSystemFont,'Segoe UI',Roboto,sans-serif;margin:0;padding:2rem;box-sizing:border-box;background:#fff4f7;color:#90435b;--dark-color:#be7b90;min-height:100vh;min-height:100dvh;display:flex;flex-direction:column;justify-content:center;align-items:center;text-align:center}h2{margin:0 0 2rem;font-size:64px;font-weight:600;background:#ffdbe6;padding:8px 30px;border-radius:100px;font-family:monospace}@media(prefers-color-scheme: dark){body{background:#1b1617;color:#ddb6c2;--dark-color:#726468}h2{background:#292122}}p{margin:0;color:var(--dark-color)}hr{border:none;height:1px;background:currentColor;opacity:.2;width:100%;max-width:300px;margin:2rem 0 1rem}footer{font-size:.9rem;color:var(--dark-color)}a{color:inherit}</style>`),
         Buffer.from(`<hr><footer>Powered by <a href="https://github.com/the-lstv/akeno" target="_blank">Akeno/${backend.version}</a></footer></html>`),
@@ -818,6 +1020,8 @@ module.exports = {
 
         if(enc.includes("br")) {
             return backend.compression.format.BROTLI;
+        } else if(enc.includes("zstd") && backend.compression.zstdSupported) {
+            return backend.compression.format.ZSTD;
         } else if(enc.includes("gzip")) {
             return backend.compression.format.GZIP;
         } else if(enc.includes("deflate")) {
@@ -878,11 +1082,7 @@ module.exports = {
         }
 
         buffer = backend.compression.compress(buffer, algorithm);
-        headers["Content-Encoding"] = {
-            [backend.compression.format.BROTLI]: "br",
-            [backend.compression.format.GZIP]: "gzip",
-            [backend.compression.format.DEFLATE]: "deflate"
-        }[algorithm];
+        backend.helper.encodedHeaders(headers, algorithm);
 
         backend.helper.send(req, res, buffer, headers, status);
         return [algorithm, buffer, headers];
@@ -1114,11 +1314,7 @@ module.exports = {
                 if (!(part.data instanceof Buffer)) part.data = Buffer.from(part.data);
 
                 if(hash) {
-                    if(hash === "xxh3") part.hash = xxh3.xxh64(part.data).toString(16); else
-                    if(hash === "xxh32") part.hash = xxh32(part.data).toString(16); else
-                    if(hash === "xxh64") part.hash = xxh64(part.data).toString(16); else
-                    if(hash === "xxh128") part.hash = xxh3.xxh128(part.data).toString(16); else
-                    part.hash = crypto.createHash('md5').update(part.data).digest('hex');
+                    part.hash = backend.helper.hash(part.data, hash);
                 }
             }
 
@@ -1144,11 +1340,7 @@ module.exports = {
                 }
 
                 if(hash) {
-                    if(hash === "xxh3") part.hash = xxh3.xxh64(part.data).toString(16); else
-                    if(hash === "xxh32") part.hash = xxh32(part.data).toString(16); else
-                    if(hash === "xxh64") part.hash = xxh64(part.data).toString(16); else
-                    if(hash === "xxh128") part.hash = xxh3.xxh128(part.data).toString(16); else
-                    part.hash = crypto.createHash('md5').update(part.data).digest('hex');
+                    part.hash = backend.helper.hash(part.data, hash);
                 }
             }
 
@@ -21,7 +21,7 @@ private:
 
     void write(const Napi::CallbackInfo& info);
     // void writeHead(const Napi::CallbackInfo& info);
-    void import(const Napi::CallbackInfo& info);
+    Napi::Value import(const Napi::CallbackInfo& info);
     Napi::Value getTagName(const Napi::CallbackInfo& info);
     void setBodyAttributes(const Napi::CallbackInfo& info);
 };
\ No newline at end of file
@@ -4,12 +4,14 @@
 #include <stack>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
 #include "../external/xxHash/xxh3.h"
 
 #include "../x-parser.cpp"
 
 class ParserContext; // Forward declaration
+class CompileWorker;
 
 class ParserWrapper : public Napi::ObjectWrap<ParserWrapper> {
 public:
@@ -18,6 +20,16 @@ public:
     HTMLParserOptions parserOptions;
     HTMLParsingContext ctx;
 
+    // Same options with the default handlers inlined, used by fromString while no JS handlers are set (see DefaultHandlers)
+    DefaultHTMLParsingContext defaultCtx;
+
+    // Same options, but JS callbacks become render slots (see RenderPlan)
+    HTMLParserOptions planOptions;
+    HTMLParsingContext planCtx;
+
+    // Set while onBatch runs, output has to be returned instead of written
+    bool batching = false;
+
 private:
     Napi::Env env_;
     Napi::FunctionReference onTextRef_;
@@ -25,9 +37,54 @@ private:
     Napi::FunctionReference onClosingTagRef_;
     Napi::FunctionReference onInlineRef_;
     Napi::FunctionReference onEndRef_;
+    Napi::FunctionReference onBatchRef_;
+
+    // Whether any handler calls into JS, set once the constructor has read all of them
+    bool jsHandlers_ = false;
+
+    // Output of the current streaming parse, drained on every write
+    std::string streamOutput_;
+
+    // Buffers returned by fromFile, one per composed document version.
+    // The same memory can't back two external buffers, so repeated calls return the same (read-only) Buffer.
+    // Both references are weak: the document lives as long as the cache entry or the Buffer itself holds it, never because of this map.
+    struct ExportedBuffer {
+        std::weak_ptr<const std::string> storage;
+        Napi::Reference<Napi::Buffer<char>> buffer;
+    };
+
+    std::unordered_map<std::string, ExportedBuffer> exportedBuffers_;
+
+    // Entries whose document was evicted from the cache (and whose Buffer was collected) are dropped once the map reaches this size
+    size_t exportedSweepAt_ = 64;
+
+    // Output of Atrium blocks and the block state they leave, by block hash, parent tag and block state (see renderBlock)
+    struct BlockOutput {
+        std::string output;
+        std::string state;
+    };
+
+    std::unordered_map<uint64_t, BlockOutput> blockOutputs_;
+    std::unordered_set<std::string> volatileBlocks_;
+    static constexpr size_t BLOCK_MEMO_LIMIT = 1024;
 
     Napi::Value createContext(const Napi::CallbackInfo& info);
     Napi::Value fromString(const Napi::CallbackInfo& info);
     Napi::Value fromFile(const Napi::CallbackInfo& info);
     Napi::Value needsUpdate(const Napi::CallbackInfo& info);
+    Napi::Value write(const Napi::CallbackInfo& info);
+    Napi::Value end(const Napi::CallbackInfo& info);
+    Napi::Value compile(const Napi::CallbackInfo& info);
+    Napi::Value render(const Napi::CallbackInfo& info);
+    Napi::Value fromFileAsync(const Napi::CallbackInfo& info);
+    Napi::Value precompile(const Napi::CallbackInfo& info);
+    Napi::Value dictionary(const Napi::CallbackInfo& info);
+
+    std::shared_ptr<const RenderPlan> compilePlan(const std::string& filePath, Napi::Object& ctxObj, bool templateEnabled);
+    Napi::Value renderPlan(const std::shared_ptr<const RenderPlan>& plan, Napi::Object& ctxObj);
+    bool renderSlot(const RenderSlot& slot, std::string& output, Napi::Object& ctxObj, Napi::Value data);
+    bool renderBatch(const RenderPlan& plan, std::string& output, Napi::Object& ctxObj, Napi::Value data);
+    void renderBlock(const AtriumBlock& block, std::string_view parent, std::string& output, Napi::Object& ctxObj);
+
+    friend class CompileWorker;
 };
\ No newline at end of file
@@ -55,9 +55,14 @@ void ParserContext::write(const Napi::CallbackInfo& info) {
         return;
     }
 
+    if (parser->batching) {
+        Napi::Error::New(info.Env(), "Output can't be written during onBatch, return it instead").ThrowAsJavaScriptException();
+        return;
+    }
+
     if (info[0].IsBuffer()) {
         Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char>>();
-        *parser->ctx.output += std::string(buffer.Data(), buffer.Length());
+        parser->ctx.output->append(buffer.Data(), buffer.Length());
         return;
     }
 
@@ -91,19 +96,33 @@ void ParserContext::setBodyAttributes(const Napi::CallbackInfo& info) {
 //     *result += info[0].As<Napi::String>().Utf8Value();
 // }
 
-void ParserContext::import(const Napi::CallbackInfo& info) {
+// During onBatch, the imported output is returned instead of written
+Napi::Value ParserContext::import(const Napi::CallbackInfo& info) {
     if (info.Length() < 1 || !info[0].IsString()) {
         Napi::TypeError::New(info.Env(), "Expected a string").ThrowAsJavaScriptException();
-        return;
+        return info.Env().Undefined();
     }
 
     std::string filePath = info[0].As<Napi::String>().Utf8Value();
 
+    std::string imported;
+    std::string* previousOutput = parser->ctx.output;
+    if (parser->batching) {
+        parser->ctx.output = &imported;
+    }
+
     try {
         parser->ctx.inlineFile(filePath);
     } catch (const std::runtime_error& e) {
         Napi::Error::New(info.Env(), e.what()).ThrowAsJavaScriptException();
     }
+
+    if (parser->batching) {
+        parser->ctx.output = previousOutput;
+        return Napi::String::New(info.Env(), imported);
+    }
+
+    return info.Env().Undefined();
 }
 
 
@@ -120,46 +139,221 @@ Napi::Object ParserWrapper::Init(Napi::Env env, Napi::Object exports) {
         InstanceMethod("fromString", &ParserWrapper::fromString),
         InstanceMethod("fromFile", &ParserWrapper::fromFile),
         InstanceMethod("createContext", &ParserWrapper::createContext),
-        InstanceMethod("needsUpdate", &ParserWrapper::needsUpdate)
+        InstanceMethod("needsUpdate", &ParserWrapper::needsUpdate),
+        InstanceMethod("write", &ParserWrapper::write),
+        InstanceMethod("end", &ParserWrapper::end),
+        InstanceMethod("compile", &ParserWrapper::compile),
+        InstanceMethod("render", &ParserWrapper::render),
+        InstanceMethod("fromFileAsync", &ParserWrapper::fromFileAsync),
+        InstanceMethod("precompile", &ParserWrapper::precompile),
+        InstanceMethod("dictionary", &ParserWrapper::dictionary)
     }));
     return exports;
 }
 
+// Text only needs to go through JS if it may contain blocks or is an inline script.
+// Styles never do, the parser minifies them itself in compact mode (see CSSMinifier).
+static bool textNeedsCallback(std::stack<std::string_view>& tagStack, std::string_view value) {
+    if (!tagStack.empty()) {
+        const auto& top = tagStack.top();
+        if (top == "script") return true;
+        if (top == "style") return false;
+    }
+
+    return value.find('@') != std::string_view::npos;
+}
+
+static void appendTextResult(std::string& buffer, const Napi::Value& result, std::string_view value) {
+    if (result.IsString()) {
+        buffer.append(result.As<Napi::String>().Utf8Value());
+    }
+
+    if (result.IsBuffer()) {
+        Napi::Buffer<char> buf = result.As<Napi::Buffer<char>>();
+        buffer.append(buf.Data(), buf.Length());
+    }
+
+    if (result.IsBoolean() && result.As<Napi::Boolean>().Value()) {
+        buffer.append(value);
+    }
+}
+
+/**
+ * Render a SLOT_DATA slot: walk its path through the request data and write the value HTML-escaped.
+ * Missing values, objects and functions leave the marker empty for the client.
+ */
+static void appendDataValue(std::string& buffer, Napi::Value data, std::string_view path) {
+    bool found = resolveDataPath(path, data, [](Napi::Value& node, std::string_view key) {
+        if (!node.IsObject()) return false;
+
+        node = node.As<Napi::Object>().Get(std::string(key));
+        return !node.IsUndefined() && !node.IsNull();
+    });
+
+    if (!found) return;
+
+    if (data.IsString()) {
+        escapeHTML(data.As<Napi::String>().Utf8Value(), buffer);
+    } else if (data.IsNumber() || data.IsBoolean()) {
+        escapeHTML(data.ToString().Utf8Value(), buffer);
+    }
+}
+
+// Everything filling the plan cache (planCtx on the main thread, compile and precompile workers) locks the page it parses
+static PathLocks planLocks;
+
+// Recording callbacks for planOptions, userData is the HTMLParsingContext doing the parsing
+static void recordTextSlot(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void* userData) {
+    if (value.empty()) return;
+
+    if (!textNeedsCallback(tagStack, value)) {
+        buffer.append(value);
+        return;
+    }
+
+    static_cast<HTMLParsingContext*>(userData)->recordSlot(SLOT_TEXT, value);
+}
+
+static void recordOpeningTagSlot(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
+    static_cast<HTMLParsingContext*>(userData)->recordSlot(SLOT_OPENING_TAG, tag);
+}
+
+static void recordClosingTagSlot(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
+    static_cast<HTMLParsingContext*>(userData)->recordSlot(SLOT_CLOSING_TAG, tag);
+}
+
+static void recordInlineSlot(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void* userData) {
+    static_cast<HTMLParsingContext*>(userData)->recordSlot(SLOT_INLINE, value);
+}
+
+static void recordBlockSlot(std::string& buffer, std::stack<std::string_view>& tagStack, const AtriumBlock& block, void* userData) {
+    static_cast<HTMLParsingContext*>(userData)->recordSlot(SLOT_BLOCK, block.source);
+}
+
+static Napi::String atriumString(Napi::Env env, std::string_view value) {
+    if (value.find('\\') == std::string_view::npos) {
+        return Napi::String::New(env, value.data(), value.size());
+    }
+
+    return Napi::String::New(env, AtriumParser::unescape(value));
+}
+
+/**
+ * The object onBlock gets: { name, attributes, properties }.
+ * Attributes are strings, or { name, values } with values in brackets. Properties are true (flags), a string, or an array of strings for lists.
+ */
+static Napi::Object blockObject(Napi::Env env, const AtriumBlock& block) {
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("name", atriumString(env, block.name));
+
+    Napi::Array attributes = Napi::Array::New(env, block.attributes.size());
+    for (uint32_t i = 0; i < block.attributes.size(); ++i) {
+        const AtriumAttribute& attribute = block.attributes[i];
+
+        if (!attribute.hasValues) {
+            attributes.Set(i, atriumString(env, attribute.name));
+            continue;
+        }
+
+        Napi::Array values = Napi::Array::New(env, attribute.values.size());
+        for (uint32_t j = 0; j < attribute.values.size(); ++j) {
+            values.Set(j, atriumString(env, attribute.values[j]));
+        }
+
+        Napi::Object entry = Napi::Object::New(env);
+        entry.Set("name", atriumString(env, attribute.name));
+        entry.Set("values", values);
+        attributes.Set(i, entry);
+    }
+    result.Set("attributes", attributes);
+
+    Napi::Object properties = Napi::Object::New(env);
+    for (const AtriumProperty& property : block.properties) {
+        Napi::Value value;
+
+        if (property.values.empty()) {
+            value = Napi::Boolean::New(env, true);
+        } else if (property.values.size() == 1) {
+            value = atriumString(env, property.values[0]);
+        } else {
+            Napi::Array values = Napi::Array::New(env, property.values.size());
+            for (uint32_t j = 0; j < property.values.size(); ++j) {
+                values.Set(j, atriumString(env, property.values[j]));
+            }
+            value = values;
+        }
+
+        properties.Set(atriumString(env, property.key), value);
+    }
+    result.Set("properties", properties);
+
+    return result;
+}
+
+static std::string appPathOf(Napi::Object& ctxObj) {
+    Napi::Value dataValue = ctxObj.Get("data");
+    if (dataValue.IsObject()) {
+        Napi::Value pathValue = dataValue.As<Napi::Object>().Get("path");
+        if (pathValue.IsString()) {
+            return pathValue.As<Napi::String>().Utf8Value();
+        }
+    }
+
+    return "";
+}
+
 ParserWrapper::ParserWrapper(const Napi::CallbackInfo& info) 
     : Napi::ObjectWrap<ParserWrapper>(info), 
       parserOptions(info.Length() > 0 && info[0].IsObject() ? info[0].As<Napi::Object>().Get("buffer").ToBoolean() : false), 
       ctx(parserOptions), 
+      defaultCtx(parserOptions),
+      planOptions(true),
+      planCtx(planOptions),
       env_(info.Env()) {
+    planOptions.recordSlots = true;
+    planCtx.cache = &planCache;
+    planCtx.locks = &planLocks;
+
     if (info.Length() > 0 && info[0].IsObject()) {
         Napi::Object opts = info[0].As<Napi::Object>();
 
         if (opts.Has("compact")) {
-            parserOptions.compact = opts.Get("compact").ToBoolean();
+            parserOptions.compact = planOptions.compact = opts.Get("compact").ToBoolean();
         }
 
         if (opts.Has("vanilla")) {
-            parserOptions.vanilla = opts.Get("vanilla").ToBoolean();
+            parserOptions.vanilla = planOptions.vanilla = opts.Get("vanilla").ToBoolean();
+        }
+
+        if (opts.Has("cloneTemplates")) {
+            parserOptions.cloneTemplates = planOptions.cloneTemplates = opts.Get("cloneTemplates").ToBoolean();
+        }
+
+        // Only plans have request data to render from
+        if (opts.Has("ssr")) {
+            planOptions.ssr = opts.Get("ssr").ToBoolean();
         }
 
         if (opts.Has("header")) {
-            parserOptions.header = opts.Get("header").ToString().Utf8Value();
+            parserOptions.header = planOptions.header = opts.Get("header").ToString().Utf8Value();
+        }
+
+        if (opts.Has("maxFileSize") && opts.Get("maxFileSize").IsNumber()) {
+            int64_t maxFileSize = opts.Get("maxFileSize").As<Napi::Number>().Int64Value();
+            if (maxFileSize > 0) {
+                parserOptions.maxFileSize = planOptions.maxFileSize = (size_t) maxFileSize;
+            }
         }
 
         if (opts.Has("onText")) {
             onTextRef_ = Napi::Persistent(opts.Get("onText").As<Napi::Function>());
+            planOptions.onText = recordTextSlot;
             parserOptions.onText = [&](std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void* userData) {
                 if (userData == nullptr || value.empty()) {
                     return;
                 }
 
-                bool isScriptOrStyle = false;
-                if (!tagStack.empty()) {
-                    const auto& top = tagStack.top();
-                    isScriptOrStyle = (top == "script" || top == "style");
-                }
-
-                bool hasAtSymbol = value.find('@') != std::string_view::npos;
-                if (!hasAtSymbol && !isScriptOrStyle) {
+                if (!textNeedsCallback(tagStack, value)) {
                     buffer.append(value);
                     return;
                 }
@@ -174,23 +368,13 @@ ParserWrapper::ParserWrapper(const Napi::CallbackInfo& info)
                 Napi::Object* obj = static_cast<Napi::Object*>(userData);
                 Napi::Value result = onTextRef_.Call({ valueStr, stackTop, *obj });
 
-                if (result.IsString()) {
-                    buffer.append(result.As<Napi::String>().Utf8Value());
-                }
-
-                if (result.IsBuffer()) {
-                    Napi::Buffer<char> buf = result.As<Napi::Buffer<char>>();
-                    buffer.append(buf.Data(), buf.Length());
-                }
-
-                if (result.IsBoolean() && result.As<Napi::Boolean>().Value()) {
-                    buffer.append(value);
-                }
+                appendTextResult(buffer, result, value);
             };
         }
 
         if (opts.Has("onOpeningTag")) {
             onOpeningTagRef_ = Napi::Persistent(opts.Get("onOpeningTag").As<Napi::Function>());
+            planOptions.onOpeningTag = recordOpeningTagSlot;
             parserOptions.onOpeningTag = [&](std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
                 if (userData == nullptr) {
                     return;
@@ -214,6 +398,7 @@ ParserWrapper::ParserWrapper(const Napi::CallbackInfo& info)
 
         if (opts.Has("onClosingTag")) {
             onClosingTagRef_ = Napi::Persistent(opts.Get("onClosingTag").As<Napi::Function>());
+            planOptions.onClosingTag = recordClosingTagSlot;
             parserOptions.onClosingTag = [&](std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
                 if (userData == nullptr) {
                     return;
@@ -237,6 +422,7 @@ ParserWrapper::ParserWrapper(const Napi::CallbackInfo& info)
 
         if (opts.Has("onInline")) {
             onInlineRef_ = Napi::Persistent(opts.Get("onInline").As<Napi::Function>());
+            planOptions.onInline = recordInlineSlot;
             parserOptions.onInline = [&](std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
                 if (userData == nullptr) {
                     return;
@@ -258,6 +444,30 @@ ParserWrapper::ParserWrapper(const Napi::CallbackInfo& info)
             };
         }
 
+        // Parse Atrium blocks natively, text without them never goes to onText (see AtriumParser)
+        if (opts.Has("blocks") && opts.Get("blocks").ToBoolean()) {
+            planOptions.onBlock = recordBlockSlot;
+            parserOptions.onBlock = [&](std::string& buffer, std::stack<std::string_view>& tagStack, const AtriumBlock& block, void* userData) {
+                if (userData == nullptr) {
+                    return;
+                }
+
+                renderBlock(block, tagStack.empty()? std::string_view(): tagStack.top(), buffer, *static_cast<Napi::Object*>(userData));
+            };
+        }
+
+        // Blocks whose output depends on more than their source and the block state (or that have side effects) are never memoized
+        if (opts.Has("volatileBlocks") && opts.Get("volatileBlocks").IsArray()) {
+            Napi::Array names = opts.Get("volatileBlocks").As<Napi::Array>();
+            for (uint32_t i = 0; i < names.Length(); ++i) {
+                volatileBlocks_.insert(names.Get(i).ToString().Utf8Value());
+            }
+        }
+
+        if (opts.Has("onBatch")) {
+            onBatchRef_ = Napi::Persistent(opts.Get("onBatch").As<Napi::Function>());
+        }
+
         if (opts.Has("onEnd")) {
             onEndRef_ = Napi::Persistent(opts.Get("onEnd").As<Napi::Function>());
             parserOptions.onEnd = [&](void* userData) {
@@ -270,6 +480,9 @@ ParserWrapper::ParserWrapper(const Napi::CallbackInfo& info)
             };
         }
     }
+
+    jsHandlers_ = !onTextRef_.IsEmpty() || !onOpeningTagRef_.IsEmpty() || !onClosingTagRef_.IsEmpty() || !onInlineRef_.IsEmpty()
+        || !onEndRef_.IsEmpty() || (bool) parserOptions.onBlock;
 }
 
 Napi::Value ParserWrapper::createContext(const Napi::CallbackInfo& info) {
@@ -289,11 +502,28 @@ Napi::Value ParserWrapper::fromString(const Napi::CallbackInfo& info) {
 
     Napi::Object ctxObj = info[1].As<Napi::Object>();
 
-    std::string result;
-    ctx.write(source, &result, &ctxObj);
-    ctx.end();
+    // Handed over to the buffer as is, so reserve close to the final size rather than growing into a larger one
+    auto result = std::make_unique<std::string>();
+    result->reserve(source.size() + source.size() / 8 + 64);
+
+    if (jsHandlers_) {
+        ctx.write(source, result.get(), &ctxObj);
+        ctx.end();
+    } else {
+        defaultCtx.write(source, result.get(), &ctxObj);
+        defaultCtx.end();
+    }
 
-    return Napi::Buffer<char>::Copy(info.Env(), result.data(), result.size());
+    std::string* storage = result.release();
+    return Napi::Buffer<char>::New(
+        info.Env(),
+        const_cast<char*>(storage->data()),
+        storage->size(),
+        [](Napi::Env env, char* data, std::string* hint) {
+            delete hint;
+        },
+        storage
+    );
 }
 
 Napi::Value ParserWrapper::fromFile(const Napi::CallbackInfo& info) {
@@ -306,37 +536,51 @@ Napi::Value ParserWrapper::fromFile(const Napi::CallbackInfo& info) {
 
     Napi::Object ctxObj = info[1].As<Napi::Object>();
 
-    std::string appPath;
-
-    Napi::Value dataValue = ctxObj.Get("data");
-    if (dataValue.IsObject()) {
-        Napi::Object dataObj = dataValue.As<Napi::Object>();
-        Napi::Value pathValue = dataObj.Get("path");
-        if (pathValue.IsString()) {
-            appPath = pathValue.As<Napi::String>().Utf8Value();
-        }
-    }
+    std::string appPath = appPathOf(ctxObj);
 
     ctx.templateEnabled = info.Length() > 2 && info[2].IsBoolean() ? info[2].As<Napi::Boolean>().Value() : false;
 
     FileCache& result = ctx.fromFile(filePath, &ctxObj, appPath);
 
-    std::shared_ptr<FileCache> resultPtr(&result, [](FileCache*) {});
+    std::shared_ptr<FileCache> entry = ctx.cache->find(result.path);
+    std::shared_ptr<const std::string> storage = ctx.exportShared(entry);
+
+    // Forget documents nothing holds anymore, so the map doesn't outgrow the (budgeted) cache.
+    // The threshold doubles with what survives, which keeps sweeping amortized O(1) per call.
+    if (exportedBuffers_.size() >= exportedSweepAt_) {
+        for (auto it = exportedBuffers_.begin(); it != exportedBuffers_.end();) {
+            it = it->second.storage.expired()? exportedBuffers_.erase(it): std::next(it);
+        }
+        exportedSweepAt_ = std::max<size_t>(64, exportedBuffers_.size() * 2);
+    }
+
+    // Nothing changed since the last call, hand out the same buffer (unless it was collected meanwhile)
+    ExportedBuffer& exported = exportedBuffers_[result.path];
+    if (!exported.buffer.IsEmpty() && exported.storage.lock() == storage) {
+        Napi::Buffer<char> existing = exported.buffer.Value();
+        if (!existing.IsEmpty()) return existing;
+    }
 
-    // Create a shared_ptr to manage the lifetime of the string data
-    auto* storagePtr = new std::shared_ptr<std::string>(std::make_shared<std::string>(std::move(ctx.exportCopy(resultPtr))));
+    // The buffer keeps its own reference to the storage, so it stays valid even after the cache moves on
+    auto* storagePtr = new std::shared_ptr<const std::string>(storage);
 
-    Napi::Value data = Napi::Buffer<char>::New(
+    Napi::Buffer<char> data = Napi::Buffer<char>::New(
         info.Env(),
-        const_cast<char*>((*storagePtr)->data()),
-        (*storagePtr)->size(),
+        const_cast<char*>(storage->data()),
+        storage->size(),
         [](Napi::Env env, char* data, void* hint) {
-            auto* sp = static_cast<std::shared_ptr<std::string>*>(hint);
+            auto* sp = static_cast<std::shared_ptr<const std::string>*>(hint);
             delete sp; // Decrease ref count and delete holder
         },
         storagePtr
     );
 
+    // Lets the server use it as an ETag without hashing the content again
+    data.Set("digest", Napi::String::New(info.Env(), entry->composedDigest.hex()));
+
+    exported.storage = storage;
+    exported.buffer = Napi::Weak(data);
+
     return data;
 }
 
@@ -348,10 +592,584 @@ Napi::Value ParserWrapper::needsUpdate(const Napi::CallbackInfo& info) {
 
     std::string filePath = info[0].As<Napi::String>().Utf8Value();
 
+    // Pages served through fromFileAsync live in the plan cache
+    if (planCache.find(filePath)) {
+        return Napi::Boolean::New(info.Env(), planCtx.needsUpdate(filePath));
+    }
+
     bool needsUpdate = ctx.needsUpdate(filePath);
     return Napi::Boolean::New(info.Env(), needsUpdate);
 }
 
+/**
+ * Streaming API - feed a document chunk by chunk (eg. from a fs.ReadStream), each call returns the output produced so far.
+ * Text goes through onText (which needs it whole), so a text or script body is only returned once it ends.
+ * <ls::template> scripts are emitted in place of the template rather than at the end of the body.
+ * parser.write(chunk, context) -> Buffer
+ * parser.end(context) -> Buffer
+ */
+Napi::Value ParserWrapper::write(const Napi::CallbackInfo& info) {
+    if (info.Length() < 2 || (!info[0].IsString() && !info[0].IsBuffer()) || !info[1].IsObject()) {
+        Napi::TypeError::New(info.Env(), "Expected a string or a buffer and a ParserContext instance").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    Napi::Object ctxObj = info[1].As<Napi::Object>();
+    streamOutput_.clear();
+
+    if (info[0].IsBuffer()) {
+        // The parser copies whatever it needs to keep, so we can read the buffer in place
+        Napi::Buffer<char> chunk = info[0].As<Napi::Buffer<char>>();
+        ctx.stream(std::string_view(chunk.Data(), chunk.Length()), &streamOutput_, &ctxObj);
+    } else {
+        std::string chunk = info[0].As<Napi::String>().Utf8Value();
+        ctx.stream(chunk, &streamOutput_, &ctxObj);
+    }
+
+    return Napi::Buffer<char>::Copy(info.Env(), streamOutput_.data(), streamOutput_.size());
+}
+
+Napi::Value ParserWrapper::end(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        Napi::TypeError::New(info.Env(), "Expected a ParserContext instance").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    Napi::Object ctxObj = info[0].As<Napi::Object>();
+    streamOutput_.clear();
+
+    ctx.stream(std::string_view(), &streamOutput_, &ctxObj);
+    ctx.end();
+
+    Napi::Value result = Napi::Buffer<char>::Copy(info.Env(), streamOutput_.data(), streamOutput_.size());
+    streamOutput_.clear();
+    streamOutput_.shrink_to_fit();
+    return result;
+}
+
+/**
+ * Render plans - compile a file once and render it for every request, only calling JS for its slots.
+ * parser.compile(filePath, context, template) -> plan (opaque)
+ * parser.render(plan | filePath, context, template) -> Buffer
+ */
+std::shared_ptr<const RenderPlan> ParserWrapper::compilePlan(const std::string& filePath, Napi::Object& ctxObj, bool templateEnabled) {
+    planCtx.templateEnabled = templateEnabled;
+    return planCtx.compile(filePath, &planCtx, appPathOf(ctxObj));
+}
+
+Napi::Value ParserWrapper::compile(const Napi::CallbackInfo& info) {
+    if (info.Length() < 2 || !info[0].IsString() || !info[1].IsObject()) {
+        Napi::TypeError::New(info.Env(), "Expected a string and a ParserContext instance").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    Napi::Object ctxObj = info[1].As<Napi::Object>();
+    bool templateEnabled = info.Length() > 2 && info[2].IsBoolean() ? info[2].As<Napi::Boolean>().Value() : false;
+
+    std::shared_ptr<const RenderPlan> plan;
+    try {
+        plan = compilePlan(info[0].As<Napi::String>().Utf8Value(), ctxObj, templateEnabled);
+    } catch (const std::exception& e) {
+        Napi::Error::New(info.Env(), e.what()).ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    return Napi::External<std::shared_ptr<const RenderPlan>>::New(
+        info.Env(),
+        new std::shared_ptr<const RenderPlan>(std::move(plan)),
+        [](Napi::Env env, std::shared_ptr<const RenderPlan>* plan) {
+            delete plan;
+        }
+    );
+}
+
+static std::string blockStateOf(Napi::Object& ctxObj) {
+    Napi::Value state = ctxObj.Get("blockState");
+    return state.IsString()? state.As<Napi::String>().Utf8Value(): std::string();
+}
+
+/**
+ * Write the output of a block: the onBlock method of the context writes it through the context.
+ * What blocks leave for later ones on the same page goes in context.blockState (a string the caller resets for every page),
+ * so a block's output and the state it leaves are memoized by AtriumBlock::hash, the parent tag and the state before it,
+ * then spliced in without calling JS again. Blocks listed in volatileBlocks, or for which onBlock returns false, always run.
+ */
+void ParserWrapper::renderBlock(const AtriumBlock& block, std::string_view parent, std::string& output, Napi::Object& ctxObj) {
+    bool memoize = volatileBlocks_.find(std::string(block.name)) == volatileBlocks_.end();
+
+    uint64_t key = 0;
+    if (memoize) {
+        std::string state = blockStateOf(ctxObj);
+        key = XXH3_64bits_withSeed(parent.data(), parent.size(), XXH3_64bits_withSeed(state.data(), state.size(), block.hash()));
+
+        auto cached = blockOutputs_.find(key);
+        if (cached != blockOutputs_.end()) {
+            output.append(cached->second.output);
+            if (cached->second.state != state) ctxObj.Set("blockState", Napi::String::New(env_, cached->second.state));
+            return;
+        }
+    }
+
+    Napi::Value onBlock = ctxObj.Get("onBlock");
+    if (!onBlock.IsFunction()) return;
+
+    size_t start = output.size();
+    Napi::Value result = onBlock.As<Napi::Function>().Call(ctxObj, { blockObject(env_, block) });
+
+    if (!memoize || env_.IsExceptionPending() || (result.IsBoolean() && !result.As<Napi::Boolean>().Value())) return;
+
+    if (blockOutputs_.size() >= BLOCK_MEMO_LIMIT) blockOutputs_.clear();
+    blockOutputs_.emplace(key, BlockOutput{ output.substr(start), blockStateOf(ctxObj) });
+}
+
+bool ParserWrapper::renderSlot(const RenderSlot& slot, std::string& output, Napi::Object& ctxObj, Napi::Value data) {
+    if (slot.type == SLOT_BODY_ATTRIBUTES) {
+        if (!ctx.body_attributes.empty()) {
+            output.append(" ").append(ctx.body_attributes);
+        }
+        return true;
+    }
+
+    if (slot.type == SLOT_DATA) {
+        appendDataValue(output, data, slot.value);
+        return true;
+    }
+
+    if (slot.type == SLOT_BLOCK) {
+        std::vector<AtriumBlock> blocks;
+        if (!AtriumParser::parse(slot.value, blocks) || blocks.size() != 1) return true;
+
+        if (!slot.parent.empty()) ctx.tagStack.push(slot.parent);
+        renderBlock(blocks[0], slot.parent, output, ctxObj);
+        if (!slot.parent.empty()) ctx.tagStack.pop();
+
+        return !env_.IsExceptionPending();
+    }
+
+    Napi::FunctionReference& callback = slot.type == SLOT_TEXT? onTextRef_:
+        slot.type == SLOT_OPENING_TAG? onOpeningTagRef_:
+        slot.type == SLOT_CLOSING_TAG? onClosingTagRef_: onInlineRef_;
+
+    if (callback.IsEmpty()) return true;
+
+    // getTagName() should see the same parent as during parsing
+    Napi::Value stackTop = env_.Null();
+    if (!slot.parent.empty()) {
+        ctx.tagStack.push(slot.parent);
+        stackTop = Napi::String::New(env_, slot.parent);
+    }
+
+    Napi::Value result = callback.Call({ Napi::String::New(env_, slot.value), stackTop, ctxObj });
+
+    if (!slot.parent.empty()) {
+        ctx.tagStack.pop();
+    }
+
+    if (env_.IsExceptionPending()) return false;
+
+    if (slot.type == SLOT_TEXT) {
+        appendTextResult(output, result, slot.value);
+    } else if (result.IsString()) {
+        output.append(result.As<Napi::String>().Utf8Value());
+    }
+
+    return true;
+}
+
+/**
+ * Dispatch every slot of a plan with one onBatch(source, events, context) call (see RenderPlan::batchEvents).
+ * It returns an array with the output of each slot (string, Buffer, true to keep the original text, or nothing).
+ */
+bool ParserWrapper::renderBatch(const RenderPlan& plan, std::string& output, Napi::Object& ctxObj, Napi::Value data) {
+    Napi::Uint32Array events = Napi::Uint32Array::New(env_, plan.batchEvents.size());
+    std::copy(plan.batchEvents.begin(), plan.batchEvents.end(), events.Data());
+
+    batching = true;
+    Napi::Value results = onBatchRef_.Call({ Napi::String::New(env_, plan.batchSource), events, ctxObj });
+    batching = false;
+
+    if (env_.IsExceptionPending()) return false;
+
+    Napi::Array resultArray = results.IsArray()? results.As<Napi::Array>(): Napi::Array::New(env_);
+    uint32_t resultCount = resultArray.Length();
+
+    size_t position = 0;
+    for (uint32_t i = 0; i < plan.slots.size(); ++i) {
+        const RenderSlot& slot = plan.slots[i];
+
+        output.append(plan.statics, position, slot.offset - position);
+        position = slot.offset;
+
+        if (slot.type == SLOT_BODY_ATTRIBUTES) {
+            if (!ctx.body_attributes.empty()) {
+                output.append(" ").append(ctx.body_attributes);
+            }
+            continue;
+        }
+
+        if (slot.type == SLOT_DATA) {
+            appendDataValue(output, data, slot.value);
+            continue;
+        }
+
+        // Blocks write through the context, which points at this output
+        if (slot.type == SLOT_BLOCK) {
+            if (!renderSlot(slot, output, ctxObj, data)) return false;
+            continue;
+        }
+
+        if (i < resultCount) {
+            Napi::Value result = resultArray.Get(i);
+
+            if (slot.type == SLOT_TEXT) {
+                appendTextResult(output, result, slot.value);
+            } else if (result.IsString()) {
+                output.append(result.As<Napi::String>().Utf8Value());
+            }
+        }
+    }
+
+    output.append(plan.statics, position, std::string::npos);
+    return true;
+}
+
+Napi::Value ParserWrapper::render(const Napi::CallbackInfo& info) {
+    if (info.Length() < 2 || (!info[0].IsExternal() && !info[0].IsString()) || !info[1].IsObject()) {
+        Napi::TypeError::New(info.Env(), "Expected a render plan or a file path and a ParserContext instance").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    Napi::Object ctxObj = info[1].As<Napi::Object>();
+
+    std::shared_ptr<const RenderPlan> plan;
+    if (info[0].IsExternal()) {
+        plan = *info[0].As<Napi::External<std::shared_ptr<const RenderPlan>>>().Data();
+    } else {
+        bool templateEnabled = info.Length() > 2 && info[2].IsBoolean() ? info[2].As<Napi::Boolean>().Value() : false;
+
+        try {
+            plan = compilePlan(info[0].As<Napi::String>().Utf8Value(), ctxObj, templateEnabled);
+        } catch (const std::exception& e) {
+            Napi::Error::New(info.Env(), e.what()).ThrowAsJavaScriptException();
+            return info.Env().Undefined();
+        }
+    }
+
+    return renderPlan(plan, ctxObj);
+}
+
+Napi::Value ParserWrapper::renderPlan(const std::shared_ptr<const RenderPlan>& plan, Napi::Object& ctxObj) {
+    auto* result = new std::string();
+    result->reserve(plan->expectedSize());
+
+    // Slot callbacks write through the context, which expects the parser output
+    std::string* previousOutput = ctx.output;
+    std::string previousBodyAttributes;
+    ctx.output = result;
+    ctx.body_attributes.swap(previousBodyAttributes);
+
+    // Request data for SLOT_DATA slots, looked up once per render
+    Napi::Value data = plan->slots.empty()? env_.Undefined(): ctxObj.Get("data");
+
+    bool ok = true;
+    if (!onBatchRef_.IsEmpty() && plan->scriptSlots > 0) {
+        ok = renderBatch(*plan, *result, ctxObj, data);
+    } else {
+        ok = plan->render(*result, [&](const RenderSlot& slot, std::string& output) {
+            return renderSlot(slot, output, ctxObj, data);
+        });
+    }
+
+    ctx.output = previousOutput;
+    ctx.body_attributes.swap(previousBodyAttributes);
+
+    if (!ok) {
+        delete result;
+        return env_.Undefined();
+    }
+
+    plan->renderedSize.store(result->size(), std::memory_order_relaxed);
+
+    // Without slots the output is exactly the statics, whose digest is already known
+    ContentDigest digest = plan->slots.empty()? plan->digest: ContentDigest::of(*result);
+
+    Napi::Buffer<char> data = Napi::Buffer<char>::New(
+        env_,
+        const_cast<char*>(result->data()),
+        result->size(),
+        [](Napi::Env env, char* data, std::string* hint) {
+            delete hint;
+        },
+        result
+    );
+
+    data.Set("digest", Napi::String::New(env_, digest.hex()));
+
+    // Rendered from the request data, so only valid for this request (see RenderPlan::dataSlots)
+    if (plan->dataSlots > 0) data.Set("perRequest", Napi::Boolean::New(env_, true));
+    return data;
+}
+
+/**
+ * Parses a page on the libuv thread pool and renders it on the main thread once done.
+ * Parsing only records slots (no JS is involved), so the main thread is only busy for the parts that actually need JS.
+ */
+class CompileWorker : public Napi::AsyncWorker {
+public:
+    CompileWorker(Napi::Env env, ParserWrapper* parser, Napi::Object& ctxObj, std::string filePath, std::string appPath, bool templateEnabled)
+        : Napi::AsyncWorker(env), deferred(Napi::Promise::Deferred::New(env)), parser(parser),
+          filePath(std::move(filePath)), appPath(std::move(appPath)), templateEnabled(templateEnabled) {
+        parserRef = Napi::Persistent(parser->Value());
+        contextRef = Napi::Persistent(ctxObj);
+
+        // The context is usually shared, so keep the data it had when the call was made
+        Napi::Value data = ctxObj.Get("data");
+        if (data.IsObject()) {
+            dataRef = Napi::Persistent(data.As<Napi::Object>());
+        }
+    }
+
+    Napi::Promise Promise() {
+        return deferred.Promise();
+    }
+
+    void Execute() override {
+        // Only waits for other threads parsing the same page (or its template)
+        HTMLParsingContext workerCtx(parser->planOptions);
+        workerCtx.cache = &planCache;
+        workerCtx.locks = &planLocks;
+        workerCtx.templateEnabled = templateEnabled;
+
+        try {
+            plan = workerCtx.compile(filePath, &workerCtx, appPath);
+        } catch (const std::exception& e) {
+            SetError(e.what());
+        }
+    }
+
+    void OnOK() override {
+        Napi::Env env = Env();
+        Napi::Object ctxObj = contextRef.Value();
+
+        if (!dataRef.IsEmpty()) {
+            ctxObj.Set("data", dataRef.Value());
+        }
+
+        Napi::Value result = parser->renderPlan(plan, ctxObj);
+
+        if (env.IsExceptionPending()) {
+            deferred.Reject(env.GetAndClearPendingException().Value());
+            return;
+        }
+
+        deferred.Resolve(result);
+    }
+
+    void OnError(const Napi::Error& error) override {
+        deferred.Reject(error.Value());
+    }
+
+private:
+    Napi::Promise::Deferred deferred;
+    ParserWrapper* parser;
+    Napi::ObjectReference parserRef;
+    Napi::ObjectReference contextRef;
+    Napi::ObjectReference dataRef;
+
+    std::string filePath;
+    std::string appPath;
+    bool templateEnabled;
+
+    std::shared_ptr<const RenderPlan> plan;
+};
+
+/**
+ * parser.fromFileAsync(filePath, context, template) -> Promise<Buffer>
+ * Same output as fromFile, but the file is read and parsed off the main thread.
+ */
+Napi::Value ParserWrapper::fromFileAsync(const Napi::CallbackInfo& info) {
+    if (info.Length() < 2 || !info[0].IsString() || !info[1].IsObject()) {
+        Napi::TypeError::New(info.Env(), "Expected a string and a ParserContext instance").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    Napi::Object ctxObj = info[1].As<Napi::Object>();
+    bool templateEnabled = info.Length() > 2 && info[2].IsBoolean() ? info[2].As<Napi::Boolean>().Value() : false;
+
+    auto* worker = new CompileWorker(info.Env(), this, ctxObj, info[0].As<Napi::String>().Utf8Value(), appPathOf(ctxObj), templateEnabled);
+    Napi::Promise promise = worker->Promise();
+    worker->Queue();
+
+    return promise;
+}
+
+/**
+ * Parses whole application directories into the plan cache on a pool of threads.
+ * Holds the plan cache for the whole run, so requests that come in meanwhile wait for it instead of parsing the same pages again.
+ */
+class PrecompileWorker : public Napi::AsyncWorker {
+public:
+    PrecompileWorker(Napi::Env env, ParserWrapper* parser, std::vector<std::string> rootDirs, size_t threadCount, bool templateEnabled, std::vector<std::string> extensions)
+        : Napi::AsyncWorker(env), deferred(Napi::Promise::Deferred::New(env)), parser(parser),
+          rootDirs(std::move(rootDirs)), threadCount(threadCount), templateEnabled(templateEnabled), extensions(std::move(extensions)) {
+        parserRef = Napi::Persistent(parser->Value());
+    }
+
+    Napi::Promise Promise() {
+        return deferred.Promise();
+    }
+
+    void Execute() override {
+        stats = ::precompile(rootDirs, parser->planOptions, planCache, threadCount, templateEnabled, extensions, &planLocks);
+    }
+
+    void OnOK() override {
+        Napi::Env env = Env();
+
+        Napi::Array errors = Napi::Array::New(env, stats.errors.size());
+        for (size_t i = 0; i < stats.errors.size(); i++) {
+            Napi::Object error = Napi::Object::New(env);
+            error.Set("file", Napi::String::New(env, stats.errors[i].first));
+            error.Set("message", Napi::String::New(env, stats.errors[i].second));
+            errors.Set(i, error);
+        }
+
+        Napi::Object result = Napi::Object::New(env);
+        result.Set("files", Napi::Number::New(env, (double) stats.files));
+        result.Set("bytes", Napi::Number::New(env, (double) stats.bytes));
+        result.Set("time", Napi::Number::New(env, stats.time));
+        result.Set("errors", errors);
+
+        deferred.Resolve(result);
+    }
+
+    void OnError(const Napi::Error& error) override {
+        deferred.Reject(error.Value());
+    }
+
+private:
+    Napi::Promise::Deferred deferred;
+    ParserWrapper* parser;
+    Napi::ObjectReference parserRef;
+
+    std::vector<std::string> rootDirs;
+    size_t threadCount;
+    bool templateEnabled;
+    std::vector<std::string> extensions;
+
+    PrecompileStats stats;
+};
+
+/**
+ * parser.precompile(rootDirs, { threads, template, extensions }) -> Promise<{ files, bytes, time, errors }>
+ * Warms the cache used by fromFileAsync with every page under the given application directories.
+ * Each directory is also the root templates are resolved against. time is in milliseconds.
+ */
+Napi::Value ParserWrapper::precompile(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1 || !info[0].IsArray()) {
+        Napi::TypeError::New(info.Env(), "Expected an array of directories").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    std::vector<std::string> rootDirs;
+    Napi::Array dirs = info[0].As<Napi::Array>();
+    for (uint32_t i = 0; i < dirs.Length(); i++) {
+        Napi::Value dir = dirs.Get(i);
+        if (!dir.IsString()) {
+            Napi::TypeError::New(info.Env(), "Expected an array of directories").ThrowAsJavaScriptException();
+            return info.Env().Undefined();
+        }
+
+        rootDirs.push_back(dir.As<Napi::String>().Utf8Value());
+    }
+
+    size_t threadCount = 0;
+    bool templateEnabled = true;
+    std::vector<std::string> extensions = { ".html", ".xw" };
+
+    if (info.Length() > 1 && info[1].IsObject()) {
+        Napi::Object opts = info[1].As<Napi::Object>();
+
+        if (opts.Has("threads") && opts.Get("threads").IsNumber()) {
+            int64_t threads = opts.Get("threads").As<Napi::Number>().Int64Value();
+            if (threads > 0) threadCount = (size_t) threads;
+        }
+
+        if (opts.Has("template")) {
+            templateEnabled = opts.Get("template").ToBoolean();
+        }
+
+        if (opts.Has("extensions") && opts.Get("extensions").IsArray()) {
+            Napi::Array list = opts.Get("extensions").As<Napi::Array>();
+            extensions.clear();
+
+            for (uint32_t i = 0; i < list.Length(); i++) {
+                std::string extension = list.Get(i).ToString().Utf8Value();
+                if (!extension.empty() && extension[0] != '.') extension.insert(0, 1, '.');
+                extensions.push_back(std::move(extension));
+            }
+        }
+    }
+
+    auto* worker = new PrecompileWorker(info.Env(), this, std::move(rootDirs), threadCount, templateEnabled, std::move(extensions));
+    Napi::Promise promise = worker->Promise();
+    worker->Queue();
+
+    return promise;
+}
+
+/**
+ * parser.dictionary(filePath) -> Buffer | undefined
+ * Shared compression dictionary of a page served through fromFileAsync - the content of its template.
+ * The buffer has a `digest` property, which only changes when the template does. Undefined if the page has no template,
+ * isn't compiled yet, or is being compiled right now.
+ */
+Napi::Value ParserWrapper::dictionary(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(info.Env(), "Expected a string").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    std::string filePath = std::filesystem::path(info[0].As<Napi::String>().Utf8Value()).lexically_normal().string();
+
+    std::shared_ptr<FileCache> entry = planCache.find(filePath);
+    if (!entry) {
+        return info.Env().Undefined();
+    }
+
+    // Don't wait for a compilation of the page or its template to finish, the dictionary can be picked up next time
+    auto pathLock = planLocks.tryLock(entry->path);
+    if (!pathLock.owns_lock() || !entry->templateCache) {
+        return info.Env().Undefined();
+    }
+
+    std::shared_ptr<FileCache> templateEntry = entry->templateCache;
+    auto templateLock = planLocks.tryLock(templateEntry->path);
+    if (!templateLock.owns_lock()) {
+        return info.Env().Undefined();
+    }
+
+    std::shared_ptr<const std::string> storage = planCtx.dictionaryOf(templateEntry);
+    if (!storage || storage->empty()) {
+        return info.Env().Undefined();
+    }
+
+    auto* storagePtr = new std::shared_ptr<const std::string>(storage);
+
+    Napi::Buffer<char> data = Napi::Buffer<char>::New(
+        info.Env(),
+        const_cast<char*>(storage->data()),
+        storage->size(),
+        [](Napi::Env env, char* data, void* hint) {
+            delete static_cast<std::shared_ptr<const std::string>*>(hint);
+        },
+        storagePtr
+    );
+
+    data.Set("digest", Napi::String::New(info.Env(), templateEntry->dictionaryDigest.hex()));
+    return data;
+}
+
 
 enum LogLevel {
     LOG_DEBUG = 0,
@@ -433,10 +1251,208 @@ void WriteLog(const Napi::CallbackInfo& info) {
 
 
 
+/**
+ * Hashing - same results as @node-rs/xxhash (hex, without leading zeros), without leaving native code.
+ * hash(data, algo) -> string, data is a Buffer, typed array or string, algo is "xxh3" (default), "xxh128", "xxh64" or "xxh32"
+ */
+static std::string hexWithoutPadding(uint64_t high, uint64_t low) {
+    char buffer[33];
+    int length = high? snprintf(buffer, sizeof(buffer), "%llx%016llx", (unsigned long long) high, (unsigned long long) low)
+                     : snprintf(buffer, sizeof(buffer), "%llx", (unsigned long long) low);
+    return std::string(buffer, length);
+}
+
+Napi::Value Hash(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    std::string text;
+    std::string_view data;
+
+    if (info.Length() > 0 && info[0].IsString()) {
+        text = info[0].As<Napi::String>().Utf8Value();
+        data = text;
+    } else if (info.Length() > 0 && info[0].IsTypedArray()) {
+        Napi::TypedArray array = info[0].As<Napi::TypedArray>();
+        data = std::string_view(static_cast<const char*>(array.ArrayBuffer().Data()) + array.ByteOffset(), array.ByteLength());
+    } else if (info.Length() > 0 && info[0].IsArrayBuffer()) {
+        Napi::ArrayBuffer buffer = info[0].As<Napi::ArrayBuffer>();
+        data = std::string_view(static_cast<const char*>(buffer.Data()), buffer.ByteLength());
+    } else {
+        Napi::TypeError::New(env, "Expected a Buffer, typed array or string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    std::string algo = info.Length() > 1 && info[1].IsString()? info[1].As<Napi::String>().Utf8Value(): "xxh3";
+
+    if (algo == "xxh3") {
+        return Napi::String::New(env, hexWithoutPadding(0, XXH3_64bits(data.data(), data.size())));
+    }
+
+    if (algo == "xxh128") {
+        XXH128_hash_t hash = XXH3_128bits(data.data(), data.size());
+        return Napi::String::New(env, hexWithoutPadding(hash.high64, hash.low64));
+    }
+
+    if (algo == "xxh64") {
+        return Napi::String::New(env, hexWithoutPadding(0, XXH64(data.data(), data.size(), 0)));
+    }
+
+    if (algo == "xxh32") {
+        return Napi::String::New(env, hexWithoutPadding(0, XXH32(data.data(), data.size(), 0)));
+    }
+
+    Napi::TypeError::New(env, "Unsupported hash algorithm: " + algo).ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+/**
+ * Escaping - same kernels the parser uses for generated code (see EscapeMode).
+ * escapeHTML(data), escapeAttribute(data), escapeJSString(data) -> Buffer for a Buffer (the same one if nothing had to be escaped), string for a string
+ */
+template <EscapeMode Mode>
+Napi::Value Escape(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    if (info.Length() > 0 && info[0].IsBuffer()) {
+        Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char>>();
+        std::string_view data(buffer.Data(), buffer.Length());
+        if (!needsEscaping<Mode>(data)) return buffer;
+
+        auto* result = new std::string();
+        result->reserve(data.size() + data.size() / 8 + 16);
+        escapeInto<Mode>(data, *result);
+
+        return Napi::Buffer<char>::New(
+            env,
+            result->data(),
+            result->size(),
+            [](Napi::Env env, char* data, std::string* hint) {
+                delete hint;
+            },
+            result
+        );
+    }
+
+    if (info.Length() > 0 && info[0].IsString()) {
+        std::string text = info[0].As<Napi::String>().Utf8Value();
+        if (!needsEscaping<Mode>(text)) return info[0];
+
+        std::string result;
+        result.reserve(text.size() + text.size() / 8 + 16);
+        escapeInto<Mode>(text, result);
+        return Napi::String::New(env, result);
+    }
+
+    Napi::TypeError::New(env, "Expected a Buffer or string").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+/**
+ * File watcher - lets JS caches check for changes without touching the filesystem.
+ * watcher.generation() -> number, changes whenever any watched file changed
+ * watcher.watch(path) -> current version of the file, or -1 if it can't be watched
+ * watcher.version(path) -> current version of the file, or -1 if it isn't watched
+ */
+Napi::Value WatcherGeneration(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), (double) FileWatcher::instance().generation());
+}
+
+Napi::Value WatcherWatch(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(info.Env(), "Expected a string").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    auto watch = FileWatcher::instance().watch(info[0].As<Napi::String>().Utf8Value());
+    return Napi::Number::New(info.Env(), watch? (double) watch->version.load(std::memory_order_acquire): -1);
+}
+
+Napi::Value WatcherVersion(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(info.Env(), "Expected a string").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    return Napi::Number::New(info.Env(), (double) FileWatcher::instance().version(info[0].As<Napi::String>().Utf8Value()));
+}
+
+/**
+ * File cache - native memory used by parsed files.
+ * cacheStats() -> { hits, misses, evictions, entries, residentBytes, budget, plans: { ... }, disk: { hits, misses, writes } }
+ * setCacheBudget(bytes) - applies to both the file and the render plan cache
+ * setDiskCache(directory) - persist render plan cache entries in a directory, so they survive restarts ("" to disable)
+ */
+static Napi::Object CacheStatsObject(Napi::Env env, const FileCacheStats& stats) {
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("hits", Napi::Number::New(env, (double) stats.hits));
+    result.Set("misses", Napi::Number::New(env, (double) stats.misses));
+    result.Set("evictions", Napi::Number::New(env, (double) stats.evictions));
+    result.Set("entries", Napi::Number::New(env, (double) stats.entries));
+    result.Set("residentBytes", Napi::Number::New(env, (double) stats.residentBytes));
+    result.Set("budget", Napi::Number::New(env, (double) stats.budget));
+    return result;
+}
+
+Napi::Value CacheStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::Object result = CacheStatsObject(env, fileCache.stats());
+    result.Set("plans", CacheStatsObject(env, planCache.stats()));
+
+    DiskCacheStats diskStats = diskCache.stats();
+    Napi::Object disk = Napi::Object::New(env);
+    disk.Set("hits", Napi::Number::New(env, (double) diskStats.hits));
+    disk.Set("misses", Napi::Number::New(env, (double) diskStats.misses));
+    disk.Set("writes", Napi::Number::New(env, (double) diskStats.writes));
+    result.Set("disk", disk);
+
+    return result;
+}
+
+void SetCacheBudget(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1 || !info[0].IsNumber() || info[0].As<Napi::Number>().Int64Value() < 0) {
+        Napi::TypeError::New(info.Env(), "Expected a non-negative number of bytes").ThrowAsJavaScriptException();
+        return;
+    }
+
+    size_t budget = (size_t) info[0].As<Napi::Number>().Int64Value();
+    fileCache.setBudget(budget);
+    planCache.setBudget(budget);
+}
+
+Napi::Value SetDiskCache(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(info.Env(), "Expected a directory").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    std::string directory = info[0].As<Napi::String>().Utf8Value();
+    bool opened = diskCache.open(directory);
+
+    planCache.disk.store(opened && !directory.empty()? &diskCache: nullptr, std::memory_order_release);
+
+    return Napi::Boolean::New(info.Env(), opened);
+}
+
 Napi::Object InitAll(Napi::Env env, Napi::Object exports) {
     ParserWrapper::Init(env, exports);
     ParserContext::Init(env, exports);
 
+    Napi::Object watcher = Napi::Object::New(env);
+    watcher.Set("active", Napi::Boolean::New(env, FileWatcher::instance().active()));
+    watcher.Set("generation", Napi::Function::New(env, WatcherGeneration));
+    watcher.Set("watch", Napi::Function::New(env, WatcherWatch));
+    watcher.Set("version", Napi::Function::New(env, WatcherVersion));
+    exports.Set("watcher", watcher);
+
+    exports.Set("cacheStats", Napi::Function::New(env, CacheStats));
+    exports.Set("setCacheBudget", Napi::Function::New(env, SetCacheBudget));
+    exports.Set("setDiskCache", Napi::Function::New(env, SetDiskCache));
+    exports.Set("hash", Napi::Function::New(env, Hash));
+
+    exports.Set("escapeHTML", Napi::Function::New(env, Escape<ESCAPE_HTML>));
+    exports.Set("escapeAttribute", Napi::Function::New(env, Escape<ESCAPE_ATTRIBUTE>));
+    exports.Set("escapeJSString", Napi::Function::New(env, Escape<ESCAPE_JS_STRING>));
+
     exports.Set("version", Napi::String::New(env, "1.1.0"));
     exports.Set("writeLog", Napi::Function::New(env, WriteLog));
 
@@ -3,7 +3,52 @@
 
 #include "x-parser.cpp"
 
-int main() {
+// Count heap allocations, so we can see what the parser allocates per document.
+// Every form of new and delete is replaced, so each pair goes through malloc and free. The deletes are kept out of line:
+// inlined into a caller, GCC sees free() on memory from operator new and warns (-Wmismatched-new-delete).
+#ifdef _MSC_VER
+#define TEST_NOINLINE __declspec(noinline)
+#else
+#define TEST_NOINLINE __attribute__((noinline))
+#endif
+
+static size_t allocationCount = 0;
+
+static void* countedAllocation(size_t size) {
+    allocationCount++;
+    if (void* ptr = std::malloc(size? size: 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) {
+    return countedAllocation(size);
+}
+
+void* operator new[](size_t size) {
+    return countedAllocation(size);
+}
+
+TEST_NOINLINE void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+TEST_NOINLINE void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+TEST_NOINLINE void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+TEST_NOINLINE void operator delete[](void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// Runs the checks, then the benchmarks (at least 100 s) - with --check only the checks.
+// Exits with 1 if any check failed.
+int main(int argc, char** argv) {
+    bool checkOnly = argc > 1 && std::string_view(argv[1]) == "--check";
+    bool failed = false;
 
     std::ifstream file("./test.xw");
     std::string code((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
@@ -32,28 +77,219 @@ int main() {
 
     // std::cout << result << std::endl;
 
-    int iterations = 0;
-    auto start = std::chrono::high_resolution_clock::now();
-    auto end = start + std::chrono::seconds(5);
-
     HTMLParsingContext ctx(options);
 
-    while (std::chrono::high_resolution_clock::now() < end) {
-        // ctx.parse(code);
+    // How many times the N-API binding calls into JS for this document with the handlers web.js sets (onText and native blocks).
+    // Parsing node by node calls onText for every text that needs it and onBlock for every block. A render plan hands all
+    // text slots to a single onBatch call (see ParserWrapper::renderBatch), blocks still go to onBlock one by one.
+    size_t textCallbacks = 0, blockCallbacks = 0, batchCallbacks = 0, blockSlots = 0;
+    {
+        auto needsJS = [](std::stack<std::string_view>& tagStack, std::string_view value) {
+            std::string_view parent = tagStack.empty()? std::string_view(): tagStack.top();
+            return parent == "script" || (parent != "style" && value.find('@') != std::string_view::npos);
+        };
+
+        HTMLParserOptions countingOptions(true);
+        countingOptions.onText = [&](std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void*) {
+            if (needsJS(tagStack, value)) textCallbacks++;
+            buffer.append(value);
+        };
+        countingOptions.onBlock = [&](std::string&, std::stack<std::string_view>&, const AtriumBlock&, void*) {
+            blockCallbacks++;
+        };
+
+        HTMLParsingContext countingCtx(countingOptions);
         std::string result;
-        ctx.write(code, &result);
-        ctx.end();
-        iterations++;
+        countingCtx.write(code, &result);
+        countingCtx.end();
+
+        // Recording the same handlers as slots, like the binding's planOptions
+        HTMLParserOptions recordingOptions(true);
+        recordingOptions.recordSlots = true;
+        HTMLParsingContext recordingCtx(recordingOptions);
+
+        recordingOptions.onText = [&](std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void*) {
+            if (needsJS(tagStack, value)) {
+                recordingCtx.recordSlot(SLOT_TEXT, value);
+            } else {
+                buffer.append(value);
+            }
+        };
+        recordingOptions.onBlock = [&](std::string&, std::stack<std::string_view>&, const AtriumBlock& block, void*) {
+            recordingCtx.recordSlot(SLOT_BLOCK, block.source);
+        };
+
+        std::shared_ptr<const RenderPlan> recorded = recordingCtx.compile("./test.xw", &recordingCtx);
+        for (const RenderSlot& slot : recorded->slots) {
+            if (slot.type == SLOT_BLOCK) blockSlots++;
+        }
+        batchCallbacks = recorded->scriptSlots > 0? 1: 0;
     }
 
-    auto duration = std::chrono::high_resolution_clock::now() - start;
-    auto duration_sec = std::chrono::duration_cast<std::chrono::seconds>(duration).count();
-    int ops = iterations / static_cast<double>(duration_sec);
-    double avg_runtime = std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / static_cast<double>(iterations);
+    std::cout << "JS callbacks per document: " << textCallbacks + blockCallbacks << " node by node (" << textCallbacks << " onText, " << blockCallbacks << " onBlock), "
+        << batchCallbacks + blockSlots << " with a render plan (" << batchCallbacks << " onBatch, " << blockSlots << " onBlock)" << std::endl;
+
+    // Output size with and without minification
+    HTMLParserOptions compactOptions(true);
+    compactOptions.compact = true;
+    HTMLParsingContext compactCtx(compactOptions);
+    size_t outputBytes = ctx.parse(code).size();
+    size_t compactBytes = compactCtx.parse(code).size();
+
+    std::cout << "Input bytes: " << code.size() << std::endl;
+    std::cout << "Output bytes: " << outputBytes << ", compact: " << compactBytes << " (" << (outputBytes > 0? 100.0 * compactBytes / outputBytes: 0) << "%)" << std::endl << std::endl;
+
+    // Plain HTML tokenizer on the same document, custom syntax is left as it is
+    HTMLParserOptions vanillaOptions(true);
+    vanillaOptions.vanilla = true;
+    HTMLParsingContext vanillaCtx(vanillaOptions);
+
+    // Same options with the default handlers inlined (see DefaultHandlers)
+    DefaultHTMLParsingContext inlinedCtx(options);
+    DefaultHTMLParsingContext inlinedCompactCtx(compactOptions);
+
+    if (inlinedCtx.parse(code) != ctx.parse(code) || inlinedCompactCtx.parse(code) != compactCtx.parse(code)) {
+        std::cout << "Inlined handlers produce different output!" << std::endl << std::endl;
+        failed = true;
+    }
+
+    // Zero rewrites only apply to declarations, selectors keep their numbers as written
+    if (minifyCSS("li:nth-child(2n+0){margin:0.0px -0em}") != "li:nth-child(2n+0){margin:0 0}") {
+        std::cout << "CSS minification changed a selector: " << minifyCSS("li:nth-child(2n+0){margin:0.0px -0em}") << std::endl << std::endl;
+        failed = true;
+    }
+
+    // A block can inline a file (@import) while the text around it is still being written, which parses with the
+    // same context - the outer text has to stay intact (run under -fsanitize=address to also catch stale reads)
+    {
+        std::string importPath = (std::filesystem::temp_directory_path() / "x-parser-test-import.html").string();
+        std::ofstream(importPath) << "<b>   imported   @print (x);   text </b>";
+
+        // The handler is set before the context is built, it reaches the context through a pointer
+        HTMLParsingContext* importingCtx = nullptr;
+
+        HTMLParserOptions blockOptions(true);
+        blockOptions.compact = true;
+        blockOptions.onBlock = [&](std::string& buffer, std::stack<std::string_view>&, const AtriumBlock& block, void*) {
+            if (block.name == "import") {
+                importingCtx->inlineFile(importPath);
+            } else {
+                buffer.append("[").append(block.name).append("]");
+            }
+        };
+
+        HTMLParsingContext blockCtx(blockOptions);
+        importingCtx = &blockCtx;
 
-    std::cout << "Total iterations: " << iterations << std::endl;
-    std::cout << "Operations per second: " << ops << std::endl;
-    std::cout << "Average runtime per iteration (microseconds): " << avg_runtime << std::endl;
+        std::string nested = blockCtx.parse("<p>  before   @import (file);   after   @print (y);  end  </p>");
+        if (nested != "<p>before <b> imported [print] text </b> after [print] end</p>") {
+            std::cout << "Nested @import changed the text around it: " << nested << std::endl << std::endl;
+            failed = true;
+        }
+
+        std::filesystem::remove(importPath);
+    }
+
+    // Block outputs are memoized by AtriumBlock::hash, which has to ignore spacing and quoting but not the values
+    {
+        std::vector<AtriumBlock> blocks;
+        AtriumParser::parse("@use (ls:5.1.0[button, tabs]) { defer; } @use(ls:5.1.0[button,tabs]){defer;} @use (ls:5.1.0[button, tab]) { defer; }", blocks);
+
+        if (blocks.size() != 3 || blocks[0].hash() != blocks[1].hash() || blocks[0].hash() == blocks[2].hash()) {
+            std::cout << "Block hashes don't match the blocks as parsed" << std::endl << std::endl;
+            failed = true;
+        }
+    }
+
+    if (checkOnly) {
+        std::cout << (failed? "Checks failed": "Checks passed") << std::endl;
+        return failed? 1: 0;
+    }
+
+    auto benchmark = [&](auto& run, ScanLevel level, const char* label) {
+        int iterations = 0;
+        size_t allocationsBefore = allocationCount;
+        auto start = std::chrono::high_resolution_clock::now();
+        auto end = start + std::chrono::seconds(5);
+
+        while (std::chrono::high_resolution_clock::now() < end) {
+            // run.parse(code);
+            std::string result;
+            run.write(code, &result);
+            run.end();
+            iterations++;
+        }
+
+        auto duration = std::chrono::high_resolution_clock::now() - start;
+        double duration_sec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / 1e6;
+        int ops = iterations / duration_sec;
+        double avg_runtime = std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / static_cast<double>(iterations);
+        double throughput = (static_cast<double>(code.size()) * iterations) / (1024 * 1024) / duration_sec;
+
+        std::cout << "[scan: " << scanLevelName(level) << ", " << label << "]" << std::endl;
+        std::cout << "Total iterations: " << iterations << std::endl;
+        std::cout << "Operations per second: " << ops << std::endl;
+        std::cout << "Average runtime per iteration (microseconds): " << avg_runtime << std::endl;
+        std::cout << "Throughput (MB/s): " << throughput << std::endl;
+        std::cout << "Heap allocations per iteration: " << (allocationCount - allocationsBefore) / static_cast<double>(iterations) << std::endl << std::endl;
+    };
+
+    // Run the same workload with every available scanner, "none" being the old byte-by-byte loop,
+    // plain and minified, through std::function callbacks and with the handlers inlined
+    for (ScanLevel level : { SCAN_NONE, SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 }) {
+        if (!setScanLevel(level)) continue;
+
+        benchmark(ctx, level, "runtime handlers");
+        benchmark(inlinedCtx, level, "inlined handlers");
+        benchmark(compactCtx, level, "runtime handlers, compact");
+        benchmark(inlinedCompactCtx, level, "inlined handlers, compact");
+        benchmark(vanillaCtx, level, "runtime handlers, vanilla");
+    }
+
+    // Per-request cost of a compiled page in ssr mode: the statics are copied and every {{ }} value is looked up and escaped.
+    // A flat map stands in for the request data object that the N-API binding walks.
+    HTMLParserOptions ssrOptions(true);
+    ssrOptions.recordSlots = true;
+    ssrOptions.ssr = true;
+    HTMLParsingContext ssrCtx(ssrOptions);
+
+    std::shared_ptr<const RenderPlan> plan = ssrCtx.compile("./test.xw", &ssrCtx);
+
+    std::unordered_map<std::string, std::string> data;
+    for (const RenderSlot& slot : plan->slots) {
+        if (slot.type == SLOT_DATA) data[slot.value] = "<b>" + slot.value + "</b> & co.";
+    }
+
+    {
+        int iterations = 0;
+        size_t allocationsBefore = allocationCount;
+        auto start = std::chrono::high_resolution_clock::now();
+        auto end = start + std::chrono::seconds(5);
+
+        while (std::chrono::high_resolution_clock::now() < end) {
+            std::string result;
+            result.reserve(plan->expectedSize());
+
+            plan->render(result, [&](const RenderSlot& slot, std::string& output) {
+                if (slot.type != SLOT_DATA) return true;
+
+                auto value = data.find(slot.value);
+                if (value != data.end()) escapeHTML(value->second, output);
+                return true;
+            });
+
+            plan->renderedSize.store(result.size(), std::memory_order_relaxed);
+            iterations++;
+        }
+
+        auto duration = std::chrono::high_resolution_clock::now() - start;
+        double avg_runtime = std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / static_cast<double>(iterations);
+
+        std::cout << "[ssr render, " << data.size() << " data values, " << plan->slots.size() << " slots]" << std::endl;
+        std::cout << "Total iterations: " << iterations << std::endl;
+        std::cout << "Average runtime per request (microseconds): " << avg_runtime << std::endl;
+        std::cout << "Heap allocations per request: " << (allocationCount - allocationsBefore) / static_cast<double>(iterations) << std::endl << std::endl;
+    }
 
-    return 0;
+    return failed? 1: 0;
 }
\ No newline at end of file
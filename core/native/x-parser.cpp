@@ -2,13 +2,50 @@
 #include <fstream>
 #include <string>
 #include <cstdint>
+#include <cstddef>
+#include <vector>
 #include <stack>
 #include <algorithm>
+#include <string_view>
 #include <unordered_set>
 #include <functional>
 #include <memory>
 #include <filesystem>
 #include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <list>
+#include <chrono>
+#include <cstring>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define XPARSER_X86 1
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <cerrno>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#define XPARSER_MMAP 1
+#endif
+
+#include "external/xxHash/xxh3.h"
 
 
 /*
@@ -24,7 +61,7 @@
     By default, this is not a pure HTML parser, it uses a custom syntax (the xw file format) for web applications.
     While it can be customized to work like a HTML parser, be cautious when using it in environments outside of Akeno or the xw file format.
 
-    Technically, with a few modifications, this could be used as a drop-in replacement for the htmlparser2 library (without features like streaming though).
+    Technically, with a few modifications, this could be used as a drop-in replacement for the htmlparser2 library.
     If someone has the time, feel free to test this out and make some benchmarks!
 
 */
@@ -40,129 +77,3086 @@
 
 */
 
-// Elements that do not have a closing tag
-std::unordered_set<std::string> voidElements = {
-    "area", "base", "br", "col", "embed", "hr", "img", "input", "link", "meta",
-    "source", "track", "command", "frame", "param", "wbr"
+/*
+    Known tags
+
+    Known tag names are resolved through a compile-time perfect hash into a small static table,
+    so looking up tag properties (void, raw, ...) never allocates or hashes a std::string.
+    Unknown tags (custom elements etc.) simply miss the table.
+*/
+
+enum TagFlags : uint8_t {
+    TAG_VOID = 1,           // Elements that do not have a closing tag
+    TAG_RAW = 2,            // Elements that only contain text content
+    TAG_HEAD = 4,
+    TAG_BODY = 8,
+    TAG_NO_RENDER = 16,     // Elements that are never written to the output (<html>, <!DOCTYPE>)
+    TAG_BLOCK = 32,         // Whitespace around these elements does not render (used when minifying)
+    TAG_CLOSES_P = 64,      // Opening one of these implicitly closes an open <p>
+    TAG_OPTIONAL_END = 128  // The closing tag may be left out in some contexts (see HTMLParsingContext::canOmitEndTag)
+};
+
+struct TagInfo {
+    std::string_view name;
+    uint8_t id;
+    uint8_t flags;
+};
+
+constexpr uint8_t TAG_FLOW = TAG_BLOCK | TAG_CLOSES_P;
+
+constexpr TagInfo knownTags[] = {
+    { "area", 0, TAG_VOID }, { "base", 1, TAG_VOID | TAG_BLOCK }, { "br", 2, TAG_VOID }, { "col", 3, TAG_VOID | TAG_BLOCK },
+    { "embed", 4, TAG_VOID }, { "hr", 5, TAG_VOID | TAG_FLOW }, { "img", 6, TAG_VOID }, { "input", 7, TAG_VOID },
+    { "link", 8, TAG_VOID | TAG_BLOCK }, { "meta", 9, TAG_VOID | TAG_BLOCK }, { "source", 10, TAG_VOID | TAG_BLOCK }, { "track", 11, TAG_VOID | TAG_BLOCK },
+    { "command", 12, TAG_VOID }, { "frame", 13, TAG_VOID }, { "param", 14, TAG_VOID | TAG_BLOCK }, { "wbr", 15, TAG_VOID },
+
+    { "script", 16, TAG_RAW }, { "style", 17, TAG_RAW | TAG_BLOCK }, { "xmp", 18, TAG_RAW | TAG_FLOW }, { "textarea", 19, TAG_RAW }, { "title", 20, TAG_RAW | TAG_BLOCK },
+
+    { "head", 21, TAG_HEAD | TAG_BLOCK }, { "body", 22, TAG_BODY | TAG_BLOCK }, { "html", 23, TAG_NO_RENDER | TAG_BLOCK }, { "!DOCTYPE", 24, TAG_NO_RENDER | TAG_BLOCK },
+
+    { "div", 25, TAG_FLOW }, { "span", 26, 0 }, { "p", 27, TAG_FLOW | TAG_OPTIONAL_END }, { "a", 28, 0 }, { "b", 29, 0 }, { "i", 30, 0 },
+    { "ul", 31, TAG_FLOW }, { "ol", 32, TAG_FLOW }, { "li", 33, TAG_BLOCK | TAG_OPTIONAL_END }, { "h1", 34, TAG_FLOW }, { "h2", 35, TAG_FLOW }, { "h3", 36, TAG_FLOW },
+    { "h4", 37, TAG_FLOW }, { "h5", 38, TAG_FLOW }, { "h6", 39, TAG_FLOW }, { "button", 40, 0 }, { "form", 41, TAG_FLOW }, { "label", 42, 0 },
+    { "select", 43, 0 }, { "option", 44, TAG_BLOCK | TAG_OPTIONAL_END }, { "table", 45, TAG_FLOW }, { "thead", 46, TAG_BLOCK | TAG_OPTIONAL_END }, { "tbody", 47, TAG_BLOCK | TAG_OPTIONAL_END }, { "tr", 48, TAG_BLOCK | TAG_OPTIONAL_END },
+    { "td", 49, TAG_BLOCK | TAG_OPTIONAL_END }, { "th", 50, TAG_BLOCK | TAG_OPTIONAL_END }, { "header", 51, TAG_FLOW }, { "footer", 52, TAG_FLOW }, { "main", 53, TAG_FLOW }, { "nav", 54, TAG_FLOW },
+    { "section", 55, TAG_FLOW }, { "article", 56, TAG_FLOW }, { "aside", 57, TAG_FLOW }, { "strong", 58, 0 }, { "em", 59, 0 }, { "code", 60, 0 },
+    { "pre", 61, TAG_FLOW }, { "svg", 62, 0 }, { "path", 63, 0 }, { "template", 64, TAG_BLOCK }, { "noscript", 65, 0 }, { "iframe", 66, 0 },
+    { "video", 67, 0 }, { "audio", 68, 0 }, { "canvas", 69, 0 }, { "small", 70, 0 }, { "picture", 71, 0 }, { "figure", 72, TAG_FLOW },
+
+    { "address", 73, TAG_FLOW }, { "blockquote", 74, TAG_FLOW }, { "details", 75, TAG_FLOW }, { "dl", 76, TAG_FLOW }, { "dt", 77, TAG_BLOCK | TAG_OPTIONAL_END },
+    { "dd", 78, TAG_BLOCK | TAG_OPTIONAL_END }, { "fieldset", 79, TAG_FLOW }, { "figcaption", 80, TAG_FLOW }, { "hgroup", 81, TAG_FLOW }, { "menu", 82, TAG_FLOW },
+    { "summary", 83, TAG_BLOCK }, { "tfoot", 84, TAG_BLOCK | TAG_OPTIONAL_END }, { "caption", 85, TAG_BLOCK }, { "colgroup", 86, TAG_BLOCK },
+    { "optgroup", 87, TAG_BLOCK | TAG_OPTIONAL_END }, { "legend", 88, TAG_BLOCK }
+};
+
+constexpr size_t KNOWN_TAG_COUNT = sizeof(knownTags) / sizeof(knownTags[0]);
+constexpr size_t TAG_TABLE_SIZE = 512;
+constexpr size_t TAG_MAX_LENGTH = 10;
+
+constexpr uint32_t tagHash(std::string_view tag, uint32_t seed) {
+    uint32_t h = seed ^ static_cast<uint32_t>(tag.size() * 0x9E3779B1u);
+    h = (h ^ static_cast<unsigned char>(tag[0])) * 0x01000193u;
+    h = (h ^ static_cast<unsigned char>(tag[tag.size() - 1])) * 0x01000193u;
+    h = (h ^ static_cast<unsigned char>(tag[tag.size() / 2])) * 0x01000193u;
+    return (h ^ (h >> 15)) & (TAG_TABLE_SIZE - 1);
+}
+
+constexpr bool tagSeedIsPerfect(uint32_t seed) {
+    bool used[TAG_TABLE_SIZE] = {};
+    for (size_t i = 0; i < KNOWN_TAG_COUNT; ++i) {
+        uint32_t slot = tagHash(knownTags[i].name, seed);
+        if (used[slot]) return false;
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t findTagSeed() {
+    uint32_t seed = 0;
+    while (!tagSeedIsPerfect(seed)) ++seed;
+    return seed;
+}
+
+constexpr uint32_t TAG_SEED = findTagSeed();
+
+struct TagTable {
+    uint8_t slots[TAG_TABLE_SIZE] = {};     // Index into knownTags + 1, 0 = empty
+
+    constexpr TagTable() {
+        for (size_t i = 0; i < KNOWN_TAG_COUNT; ++i) {
+            slots[tagHash(knownTags[i].name, TAG_SEED)] = static_cast<uint8_t>(i + 1);
+        }
+    }
+};
+
+constexpr TagTable tagTable;
+
+constexpr const TagInfo* lookupTag(std::string_view tag) {
+    if (tag.empty() || tag.size() > TAG_MAX_LENGTH) return nullptr;
+    uint8_t index = tagTable.slots[tagHash(tag, TAG_SEED)];
+    if (index == 0 || knownTags[index - 1].name != tag) return nullptr;
+    return &knownTags[index - 1];
+}
+
+constexpr uint8_t tagFlags(std::string_view tag) {
+    const TagInfo* info = lookupTag(tag);
+    return info? info->flags: 0;
+}
+
+constexpr uint8_t TAG_ID_PRE = 61;
+
+static_assert(lookupTag("pre")->id == TAG_ID_PRE, "Tag ids are broken");
+static_assert(tagFlags("br") == TAG_VOID && tagFlags("script") == TAG_RAW && tagFlags("my-element") == 0, "Tag table is broken");
+
+
+/*
+    Byte classes
+
+    Replaces std::isspace and the delimiter comparisons in the attribute/tag states with a single table lookup.
+*/
+
+enum CharClass : uint8_t {
+    CHAR_SPACE = 1,         // Same set as std::isspace in the "C" locale
+    CHAR_TAG_END = 2,       // Ends a tag name: whitespace, '>' or '/'
+    CHAR_ATTR_END = 4,      // Ends an attribute name: whitespace, '=', '>' or '/'
+    CHAR_VALUE_END = 8,     // Ends an unquoted attribute value: whitespace or '>'
+    CHAR_NEEDS_QUOTES = 16  // Can not appear in an unquoted attribute value: whitespace, quotes, '=', '<', '>' or '`'
+};
+
+struct CharClassTable {
+    uint8_t classes[256] = {};
+
+    constexpr CharClassTable() {
+        for (unsigned char c : { ' ', '\t', '\n', '\v', '\f', '\r' }) {
+            classes[c] = CHAR_SPACE | CHAR_TAG_END | CHAR_ATTR_END | CHAR_VALUE_END | CHAR_NEEDS_QUOTES;
+        }
+
+        classes[static_cast<unsigned char>('>')] = CHAR_TAG_END | CHAR_ATTR_END | CHAR_VALUE_END | CHAR_NEEDS_QUOTES;
+        classes[static_cast<unsigned char>('/')] = CHAR_TAG_END | CHAR_ATTR_END;
+        classes[static_cast<unsigned char>('=')] = CHAR_ATTR_END | CHAR_NEEDS_QUOTES;
+
+        for (unsigned char c : { '"', '\'', '<', '`' }) {
+            classes[c] = CHAR_NEEDS_QUOTES;
+        }
+    }
+};
+
+constexpr CharClassTable charClassTable;
+
+constexpr bool hasCharClass(char c, uint8_t mask) {
+    return (charClassTable.classes[static_cast<unsigned char>(c)] & mask) != 0;
+}
+
+constexpr bool isSpace(char c) {
+    return hasCharClass(c, CHAR_SPACE);
+}
+
+enum HTMLParserState {
+    TEXT,
+    TAGNAME,
+    ATTRIBUTE,
+    ATTRIBUTE_VALUE,
+    COMMENT,
+    INLINE_VALUE,
+    RAW_ELEMENT,
+    TEMPLATE_PATH
+};
+
+
+/*
+    Attribute minification
+
+    Used in compact mode to shorten attributes while they are written: boolean attributes lose their value,
+    values that only repeat the browser default are dropped entirely, and quotes are left out where HTML allows it.
+*/
+
+constexpr std::string_view booleanAttributes[] = {
+    "allowfullscreen", "async", "autofocus", "autoplay", "checked", "controls", "default", "defer", "disabled",
+    "formnovalidate", "inert", "ismap", "itemscope", "loop", "multiple", "muted", "nomodule", "novalidate", "open",
+    "playsinline", "readonly", "required", "reversed", "selected"
+};
+
+constexpr bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z') x += 'a' - 'A';
+        if (y >= 'A' && y <= 'Z') y += 'a' - 'A';
+        if (x != y) return false;
+    }
+    return true;
+}
+
+constexpr bool isBooleanAttribute(std::string_view name) {
+    for (std::string_view attribute : booleanAttributes) {
+        if (equalsIgnoreCase(name, attribute)) return true;
+    }
+    return false;
+}
+
+/**
+ * Whether the attribute value is what the browser assumes anyway.
+ * Deliberately short: input[type=text] and similar are left alone, since CSS selectors may match on them.
+ */
+constexpr bool isDefaultAttribute(const TagInfo* tag, std::string_view name, std::string_view value) {
+    if (!tag) return false;
+
+    switch (tag->id) {
+        case 16: // script
+            return (equalsIgnoreCase(name, "type") && equalsIgnoreCase(value, "text/javascript")) ||
+                   (equalsIgnoreCase(name, "language") && equalsIgnoreCase(value, "javascript"));
+        case 8:  // link
+        case 17: // style
+            return equalsIgnoreCase(name, "type") && equalsIgnoreCase(value, "text/css");
+        case 41: // form
+            return equalsIgnoreCase(name, "method") && equalsIgnoreCase(value, "get");
+    }
+    return false;
+}
+
+constexpr bool canOmitQuotes(std::string_view value) {
+    if (value.empty() || value.back() == '/') return false;
+    for (char c : value) {
+        if (hasCharClass(c, CHAR_NEEDS_QUOTES)) return false;
+    }
+    return true;
+}
+
+static_assert(isBooleanAttribute("Disabled") && !isBooleanAttribute("hidden") && canOmitQuotes("a-b") && !canOmitQuotes("a b"), "Attribute tables are broken");
+
+
+/*
+    CSS minification
+
+    Used in compact mode on <style> bodies, so inline styles never have to leave native code.
+    Runs in one pass over the input: whitespace and comments are dropped where they do not separate tokens,
+    and within declarations colors and numbers are shortened (#aabbcc -> #abc, 0px -> 0, 0.5 -> .5).
+
+    Whether a statement is a declaration or a selector is only known at its end (';' / '}' vs '{'),
+    so value rewrites are collected as deletions in the output and only applied once the statement turns out to be a declaration.
+    Custom properties (--name) are only trimmed and keep their value otherwise untouched.
+*/
+
+class CSSMinifier {
+public:
+    void minify(std::string_view css, std::string& out) {
+        this->out = &out;
+        deletions.clear();
+        pendingSpace = pendingComment = false;
+        parenDepth = customDepth = 0;
+        lastSemicolon = std::string::npos;
+        beginStatement();
+
+        const char* it = css.data();
+        const char* end = it + css.size();
+
+        while (it < end) {
+            char c = *it;
+
+            if (isSpace(c)) {
+                pendingSpace = true;
+                ++it;
+                continue;
+            }
+
+            if (c == '/' && it + 1 < end && it[1] == '*') {
+                const char* close = it + 2;
+                while (close + 1 < end && !(close[0] == '*' && close[1] == '/')) ++close;
+                close = close + 1 < end? close + 2: end;
+
+                // Keep /*! ... */ (licenses), drop everything else
+                if (it + 2 < end && it[2] == '!') {
+                    emitSpace(c);
+                    out.append(it, close - it);
+                } else {
+                    pendingComment = true;
+                }
+
+                it = close;
+                continue;
+            }
+
+            if (c == '"' || c == '\'') {
+                const char* string_end = it + 1;
+                while (string_end < end && *string_end != c && *string_end != '\n') {
+                    if (*string_end == '\\' && string_end + 1 < end) ++string_end;
+                    ++string_end;
+                }
+                if (string_end < end && *string_end == c) ++string_end;
+
+                emit(it, string_end);
+                it = string_end;
+                continue;
+            }
+
+            if (isNameStart(it, end)) {
+                const char* name_end = scanName(it, end);
+
+                if (statementStart && name_end - it >= 2 && it[0] == '-' && it[1] == '-') {
+                    custom = true;
+                }
+
+                emit(it, name_end);
+                it = name_end;
+
+                // url() contents are not tokens, copy them as they are unless quoted
+                if (it < end && *it == '(' && it - 3 >= css.data() && equalsIgnoreCase(std::string_view(it - 3, 3), "url")) {
+                    const char* arg = it + 1;
+                    while (arg < end && isSpace(*arg)) ++arg;
+
+                    if (arg < end && *arg != '"' && *arg != '\'') {
+                        const char* arg_end = arg;
+                        while (arg_end < end && *arg_end != ')') ++arg_end;
+
+                        const char* trimmed_end = arg_end;
+                        while (trimmed_end > arg && isSpace(trimmed_end[-1])) --trimmed_end;
+
+                        out.append(1, '(').append(arg, trimmed_end - arg);
+                        if (arg_end < end) out.append(1, ')');
+
+                        it = arg_end < end? arg_end + 1: end;
+                        continue;
+                    }
+                }
+                continue;
+            }
+
+            if (isNumberStart(it, end)) {
+                it = number(it, end);
+                continue;
+            }
+
+            if (c == '#') {
+                const char* hash_end = scanName(it + 1, end);
+                shortenColor(emit(it, hash_end), hash_end - it);
+                it = hash_end;
+                continue;
+            }
+
+            switch (c) {
+                case '{':
+                    emit(it, it + 1);
+                    if (custom && colon) {
+                        ++customDepth;
+                    } else {
+                        beginStatement();
+                    }
+                    break;
+
+                case '}':
+                    if (customDepth > 0) {
+                        --customDepth;
+                        emit(it, it + 1);
+                        break;
+                    }
+
+                    endStatement();
+                    emitSpace(c);
+
+                    // a{b:c;} -> a{b:c}
+                    if (!out.empty() && lastSemicolon == out.size() - 1) out.pop_back();
+
+                    out.append(1, '}');
+                    beginStatement();
+                    break;
+
+                case ';':
+                    if (customDepth > 0 || parenDepth > 0) {
+                        emit(it, it + 1);
+                        break;
+                    }
+
+                    // Empty statement
+                    if (!out.empty() && lastSemicolon == out.size() - 1) break;
+
+                    endStatement();
+                    emitSpace(c);
+                    out.append(1, ';');
+                    lastSemicolon = out.size() - 1;
+                    beginStatement();
+                    break;
+
+                case ':':
+                    emit(it, it + 1);
+                    if (parenDepth == 0 && !colon) {
+                        colon = true;
+
+                        // Space before the colon matters in selectors (a :hover), but not in declarations
+                        size_t colonAt = out.size() - 1;
+                        if (colonAt > propertyStart && out[colonAt - 1] == ' ') {
+                            deletions.emplace_back(--colonAt, 1);
+                        }
+
+                        std::string_view property(out.data() + propertyStart, colonAt - propertyStart);
+                        keepZeroUnits = custom || property == "flex" || property == "flex-basis";
+                    }
+                    break;
+
+                case '(':
+                    emit(it, it + 1);
+                    ++parenDepth;
+                    break;
+
+                case ')':
+                    emit(it, it + 1);
+                    if (parenDepth > 0) --parenDepth;
+                    break;
+
+                default:
+                    emit(it, it + 1);
+            }
+
+            ++it;
+        }
+
+        endStatement();
+    }
+
+private:
+    std::string* out = nullptr;
+
+    // Output ranges (position, length) to remove if the current statement is a declaration
+    std::vector<std::pair<size_t, size_t>> deletions;
+
+    bool pendingSpace = false;
+    bool pendingComment = false;
+    bool statementStart = true;
+    bool colon = false;
+    bool custom = false;
+    bool keepZeroUnits = false;
+    size_t propertyStart = 0;
+    size_t parenDepth = 0;
+    size_t customDepth = 0;
+    size_t lastSemicolon = std::string::npos;
+
+    static constexpr std::string_view zeroUnits[] = {
+        "px", "em", "rem", "ex", "ch", "vw", "vh", "vmin", "vmax", "cm", "mm", "in", "pt", "pc", "q"
+    };
+
+    static bool isNameChar(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' || static_cast<unsigned char>(c) >= 0x80;
+    }
+
+    static bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    static bool isNameStart(const char* it, const char* end) {
+        char c = *it;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '\\' || static_cast<unsigned char>(c) >= 0x80) return true;
+        if (c != '-' || it + 1 >= end) return false;
+        return it[1] == '-' || (!isDigit(it[1]) && isNameChar(it[1])) || it[1] == '\\';
+    }
+
+    static bool isNumberStart(const char* it, const char* end) {
+        if (isDigit(*it)) return true;
+        if (*it == '.') return it + 1 < end && isDigit(it[1]);
+        if (*it == '-' || *it == '+') {
+            return it + 1 < end && (isDigit(it[1]) || (it[1] == '.' && it + 2 < end && isDigit(it[2])));
+        }
+        return false;
+    }
+
+    static const char* scanName(const char* it, const char* end) {
+        while (it < end) {
+            if (*it == '\\') {
+                it += it + 1 < end? 2: 1;
+            } else if (isNameChar(*it)) {
+                ++it;
+            } else {
+                break;
+            }
+        }
+        return it;
+    }
+
+    // Whitespace before or after these never separates tokens
+    static bool dropsSpaceBefore(char c) {
+        return c == '{' || c == '}' || c == ';' || c == ',' || c == '>' || c == '~' || c == ')' || c == '!';
+    }
+
+    static bool dropsSpaceAfter(char c) {
+        return c == '{' || c == '}' || c == ';' || c == ',' || c == '>' || c == '~' || c == '(' || c == ':';
+    }
+
+    void emitSpace(char next) {
+        if (pendingSpace && !out->empty() && !dropsSpaceAfter(out->back()) && !dropsSpaceBefore(next)) {
+            out->append(1, ' ');
+        } else if (pendingSpace && custom && !out->empty() && out->back() == ':' && (next == ';' || next == '}')) {
+            // Keep custom properties with an empty value valid for older browsers (--x: ;)
+            out->append(1, ' ');
+        } else if (pendingComment && !pendingSpace && !out->empty() && isNameChar(out->back()) && (isNameChar(next) || next == '\\')) {
+            // A removed comment still separated two names (a/**/b)
+            out->append("/**/");
+        }
+        pendingSpace = pendingComment = false;
+    }
+
+    // Returns where the token starts in the output
+    size_t emit(const char* from, const char* to) {
+        emitSpace(*from);
+        if (statementStart) {
+            statementStart = false;
+            propertyStart = out->size();
+        }
+
+        size_t at = out->size();
+        out->append(from, to - from);
+        return at;
+    }
+
+    void beginStatement() {
+        statementStart = true;
+        colon = custom = keepZeroUnits = false;
+        parenDepth = 0;
+        deletions.clear();
+    }
+
+    /**
+     * Applies the collected deletions in a single compaction of the statement's tail.
+     */
+    void endStatement() {
+        if (deletions.empty()) return;
+
+        if (colon && !custom) {
+            std::string& buffer = *out;
+            size_t write = deletions[0].first;
+            size_t read = write;
+
+            for (auto& [at, length] : deletions) {
+                std::memmove(&buffer[write], &buffer[read], at - read);
+                write += at - read;
+                read = at + length;
+            }
+
+            std::memmove(&buffer[write], &buffer[read], buffer.size() - read);
+            buffer.resize(write + buffer.size() - read);
+        }
+
+        deletions.clear();
+    }
+
+    /**
+     * #aabbcc -> #abc, #aabbccdd -> #abcd
+     */
+    void shortenColor(size_t at, size_t length) {
+        if (!colon || custom || (length != 7 && length != 9)) return;
+
+        const char* hex = out->data() + at + 1;
+        for (size_t i = 0; i < length - 1; ++i) {
+            if (!std::isxdigit(static_cast<unsigned char>(hex[i]))) return;
+        }
+
+        for (size_t i = 0; i < length - 1; i += 2) {
+            if (std::tolower(static_cast<unsigned char>(hex[i])) != std::tolower(static_cast<unsigned char>(hex[i + 1]))) return;
+        }
+
+        for (size_t i = 2; i < length; i += 2) {
+            deletions.emplace_back(at + i, 1);
+        }
+    }
+
+    /**
+     * Copies a number with its unit and shortens it: 0px -> 0, 0.0 -> 0, 0.5 -> .5, -0.5 -> -.5
+     */
+    const char* number(const char* it, const char* end) {
+        const char* start = it;
+        if (*it == '-' || *it == '+') ++it;
+
+        const char* integer = it;
+        while (it < end && isDigit(*it)) ++it;
+        const char* integer_end = it;
+
+        bool fraction = it + 1 < end && *it == '.' && isDigit(it[1]);
+        if (fraction) {
+            ++it;
+            while (it < end && isDigit(*it)) ++it;
+        }
+
+        bool exponent = false;
+        if (it + 1 < end && (*it == 'e' || *it == 'E') && (isDigit(it[1]) || ((it[1] == '-' || it[1] == '+') && it + 2 < end && isDigit(it[2])))) {
+            exponent = true;
+            it += 2;
+            while (it < end && isDigit(*it)) ++it;
+        }
+
+        const char* number_end = it;
+        const char* unit_end = it < end && *it == '%'? it + 1: scanName(it, end);
+
+        size_t at = emit(start, unit_end);
+
+        if (!colon || custom || exponent) return unit_end;
+
+        bool zero = true;
+        for (const char* digit = integer; digit < number_end; ++digit) {
+            if (isDigit(*digit) && *digit != '0') {
+                zero = false;
+                break;
+            }
+        }
+
+        std::string_view unit(number_end, unit_end - number_end);
+
+        if (zero) {
+            bool dropUnit = unit.empty();
+            if (!dropUnit && parenDepth == 0 && !keepZeroUnits) {
+                for (std::string_view zeroUnit : zeroUnits) {
+                    if (equalsIgnoreCase(unit, zeroUnit)) {
+                        dropUnit = true;
+                        break;
+                    }
+                }
+            }
+
+            if (dropUnit && unit_end - start > 1) {
+                // Keep one of the 0 digits and drop everything around it, like every other rewrite this
+                // only happens once the statement turns out to be a declaration (nth-child(2n+0) is a selector)
+                size_t digit = std::find(start, unit_end, '0') - start;
+                if (digit > 0) deletions.emplace_back(at, digit);
+                if (digit + 1 < static_cast<size_t>(unit_end - start)) deletions.emplace_back(at + digit + 1, unit_end - start - digit - 1);
+                return unit_end;
+            }
+        }
+
+        if (fraction && integer_end - integer == 1 && *integer == '0') {
+            deletions.emplace_back(at + (integer - start), 1);
+        }
+
+        return unit_end;
+    }
+};
+
+/**
+ * Minifies a stylesheet, see CSSMinifier.
+ */
+inline std::string minifyCSS(std::string_view css) {
+    std::string result;
+    result.reserve(css.size());
+    CSSMinifier().minify(css, result);
+    return result;
+}
+
+
+/*
+    Fast byte scanning
+
+    In the TEXT, RAW_ELEMENT and COMMENT states only one or two byte values can ever change the state,
+    so instead of running the whole state machine per byte, we jump straight to the next candidate.
+    The best implementation is picked once at startup (AVX2 > SSE2 > scalar).
+*/
+
+enum ScanLevel {
+    SCAN_NONE,      // Visit every byte (no fast-scan)
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+};
+
+typedef const char* (*ScanFunction)(const char* it, const char* end, char a, char b);
+
+static inline unsigned countTrailingZeros(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static const char* scanBytesScalar(const char* it, const char* end, char a, char b) {
+    while (it < end && *it != a && *it != b) ++it;
+    return it;
+}
+
+#ifdef XPARSER_X86
+static const char* scanBytesSSE2(const char* it, const char* end, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+
+    while (end - it >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        uint32_t mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+        if (mask) return it + countTrailingZeros(mask);
+        it += 16;
+    }
+
+    return scanBytesScalar(it, end, a, b);
+}
+
+#ifdef __GNUC__
+__attribute__((target("avx2")))
+#endif
+static const char* scanBytesAVX2(const char* it, const char* end, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+
+    while (end - it >= 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb)));
+        if (mask) return it + countTrailingZeros(mask);
+        it += 32;
+    }
+
+    return scanBytesSSE2(it, end, a, b);
+}
+#endif
+
+/**
+ * Finds the first whitespace that would not survive minification as is (anything but a single ' '),
+ * which is rare in text, so the common case is one pass over the text in 16 byte steps.
+ * Other control bytes are reported as well, the caller has to check with isSpace.
+ */
+static const char* findCollapsibleSpace(const char* it, const char* end) {
+#ifdef XPARSER_X86
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i control = _mm_set1_epi8(0x1F);
+
+    while (end - it > 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it + 1));
+
+        __m128i isControl = _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk);
+        __m128i isDoubleSpace = _mm_and_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(_mm_min_epu8(next, space), next));
+
+        uint32_t mask = _mm_movemask_epi8(_mm_or_si128(isControl, isDoubleSpace));
+        if (mask) return it + countTrailingZeros(mask);
+        it += 16;
+    }
+#endif
+
+    for (; it < end; ++it) {
+        unsigned char c = *it;
+        if (c < ' ' || (c == ' ' && it + 1 < end && static_cast<unsigned char>(it[1]) <= ' ')) return it;
+    }
+    return end;
+}
+
+static bool scanLevelSupported(ScanLevel level) {
+    switch (level) {
+        case SCAN_NONE:
+        case SCAN_SCALAR:
+            return true;
+#ifdef XPARSER_X86
+        case SCAN_SSE2:
+            return true;
+        case SCAN_AVX2:
+#if defined(__GNUC__)
+            return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+            {
+                int info[4];
+                __cpuidex(info, 7, 0);
+                return (info[1] & (1 << 5)) != 0;
+            }
+#else
+            return false;
+#endif
+#endif
+        default:
+            return false;
+    }
+}
+
+static ScanFunction scanFunctionFor(ScanLevel level) {
+    switch (level) {
+#ifdef XPARSER_X86
+        case SCAN_AVX2: return scanBytesAVX2;
+        case SCAN_SSE2: return scanBytesSSE2;
+#endif
+        case SCAN_SCALAR: return scanBytesScalar;
+        default: return nullptr;
+    }
+}
+
+static ScanLevel detectScanLevel() {
+    if (scanLevelSupported(SCAN_AVX2)) return SCAN_AVX2;
+    if (scanLevelSupported(SCAN_SSE2)) return SCAN_SSE2;
+    return SCAN_SCALAR;
+}
+
+static ScanLevel scanLevel = detectScanLevel();
+static ScanFunction scanBytes = scanFunctionFor(scanLevel);
+
+/**
+ * Force a specific scanner implementation (mostly useful for benchmarks).
+ * Returns false if the level is not supported by this CPU/build.
+ */
+bool setScanLevel(ScanLevel level) {
+    if (!scanLevelSupported(level)) return false;
+    scanLevel = level;
+    scanBytes = scanFunctionFor(level);
+    return true;
+}
+
+const char* scanLevelName(ScanLevel level) {
+    switch (level) {
+        case SCAN_NONE: return "none";
+        case SCAN_SCALAR: return "scalar";
+        case SCAN_SSE2: return "sse2";
+        case SCAN_AVX2: return "avx2";
+        default: return "unknown";
+    }
+}
+
+
+/*
+    Escaping
+
+    HTML, attribute and JavaScript string escapers, used for generated code and exported to JS by the binding.
+    Most text has nothing or little to escape, so the next special byte is found 16 bytes at a time and the clean
+    run before it is copied with a single append.
+*/
+
+enum EscapeMode : uint8_t {
+    ESCAPE_HTML,        // Text and attribute values in either quotes: & < > " '
+    ESCAPE_ATTRIBUTE,   // Double-quoted attribute values: & "
+    ESCAPE_JS_STRING    // Body of a single or double-quoted JavaScript string, safe inside <script> too (< becomes \x3C)
+};
+
+template <EscapeMode Mode>
+constexpr bool needsEscape(unsigned char c) {
+    if constexpr (Mode == ESCAPE_HTML) return c == '&' || c == '<' || c == '>' || c == '"' || c == '\'';
+    if constexpr (Mode == ESCAPE_ATTRIBUTE) return c == '&' || c == '"';
+    return c < 0x20 || c == '\\' || c == '"' || c == '\'' || c == '<';
+}
+
+template <EscapeMode Mode>
+static const char* findEscape(const char* it, const char* end) {
+#ifdef XPARSER_X86
+    const __m128i amp = _mm_set1_epi8('&'), lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>');
+    const __m128i quote = _mm_set1_epi8('"'), apos = _mm_set1_epi8('\''), backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+
+    while (end - it >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        __m128i found = _mm_cmpeq_epi8(chunk, quote);
+
+        if constexpr (Mode == ESCAPE_HTML) {
+            found = _mm_or_si128(found, _mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, apos)));
+            found = _mm_or_si128(found, _mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, gt)));
+        } else if constexpr (Mode == ESCAPE_ATTRIBUTE) {
+            found = _mm_or_si128(found, _mm_cmpeq_epi8(chunk, amp));
+        } else {
+            found = _mm_or_si128(found, _mm_or_si128(_mm_cmpeq_epi8(chunk, backslash), _mm_cmpeq_epi8(chunk, apos)));
+            found = _mm_or_si128(found, _mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk)));
+        }
+
+        uint32_t mask = _mm_movemask_epi8(found);
+        if (mask) return it + countTrailingZeros(mask);
+        it += 16;
+    }
+#endif
+
+    while (it < end && !needsEscape<Mode>(*it)) ++it;
+    return it;
+}
+
+template <EscapeMode Mode>
+static void appendEscapeSequence(std::string& out, unsigned char c) {
+    if constexpr (Mode == ESCAPE_JS_STRING) {
+        switch (c) {
+            case '\n': out += "\\n"; return;
+            case '\r': out += "\\r"; return;
+            case '\t': out += "\\t"; return;
+            case '\\': out += "\\\\"; return;
+            case '"': out += "\\\""; return;
+            case '\'': out += "\\'"; return;
+        }
+
+        static const char digits[] = "0123456789ABCDEF";
+        const char sequence[4] = { '\\', 'x', digits[c >> 4], digits[c & 15] };
+        out.append(sequence, 4);
+        return;
+    }
+
+    switch (c) {
+        case '&': out += "&amp;"; return;
+        case '<': out += "&lt;"; return;
+        case '>': out += "&gt;"; return;
+        case '"': out += "&quot;"; return;
+        case '\'': out += "&#39;"; return;
+    }
+}
+
+/**
+ * Appends the escaped input to out.
+ */
+template <EscapeMode Mode>
+void escapeInto(std::string_view input, std::string& out) {
+    const char* it = input.data();
+    const char* end = it + input.size();
+
+    while (true) {
+        const char* next = findEscape<Mode>(it, end);
+        out.append(it, next - it);
+        if (next == end) return;
+
+        appendEscapeSequence<Mode>(out, *next);
+        it = next + 1;
+    }
+}
+
+/**
+ * Whether the input would change when escaped (the binding hands unchanged input back as is).
+ */
+template <EscapeMode Mode>
+bool needsEscaping(std::string_view input) {
+    return findEscape<Mode>(input.data(), input.data() + input.size()) != input.data() + input.size();
+}
+
+inline void escapeHTML(std::string_view input, std::string& out) { escapeInto<ESCAPE_HTML>(input, out); }
+inline void escapeAttribute(std::string_view input, std::string& out) { escapeInto<ESCAPE_ATTRIBUTE>(input, out); }
+inline void escapeJSString(std::string_view input, std::string& out) { escapeInto<ESCAPE_JS_STRING>(input, out); }
+
+
+/*
+    Atrium blocks
+
+    Text can contain blocks in the Atrium syntax, which the application expands into markup (eg. @use, @page):
+
+        @name (attribute, attribute[value, value]) { key: value, value; flag; # comment }
+
+    Attributes and properties are optional - "@name;", "@name (attributes)" and a single "@name key: value;" work too.
+    With an onBlock handler, text is split here and only the parsed blocks are handed over, the text around them is
+    written as is. Anything the parser isn't sure about (an email address, a missing semicolon) sends the whole text
+    to onText instead, like before.
+
+    Names and values are views into the parsed text. Quotes are stripped, backslash escapes are kept (see unescape).
+*/
+
+struct AtriumAttribute {
+    std::string_view name;
+
+    // Values in brackets, eg. google-fonts[Poppins, Roboto]
+    std::vector<std::string_view> values;
+    bool hasValues = false;
+};
+
+struct AtriumProperty {
+    std::string_view key;
+
+    // No values means a flag, eg. "defer;"
+    std::vector<std::string_view> values;
+};
+
+struct AtriumBlock {
+    std::string_view name;
+
+    // The whole block as written, from the @ to its end
+    std::string_view source;
+
+    std::vector<AtriumAttribute> attributes;
+    std::vector<AtriumProperty> properties;
+
+    /**
+     * xxh3 of the block as parsed, so the same block hashes the same however it is spaced or quoted.
+     */
+    uint64_t hash() const {
+        std::string normalized;
+        auto add = [&](char kind, std::string_view value) {
+            uint32_t size = (uint32_t) value.size();
+            normalized += kind;
+            normalized.append(reinterpret_cast<const char*>(&size), sizeof(size));
+            normalized.append(value);
+        };
+
+        add('n', name);
+
+        for (const AtriumAttribute& attribute : attributes) {
+            add(attribute.hasValues? '[': 'a', attribute.name);
+            for (std::string_view value : attribute.values) add('v', value);
+        }
+
+        for (const AtriumProperty& property : properties) {
+            add('p', property.key);
+            for (std::string_view value : property.values) add('v', value);
+        }
+
+        return XXH3_64bits(normalized.data(), normalized.size());
+    }
+};
+
+class AtriumParser {
+public:
+    /**
+     * Parse every block in text (blocks is cleared first). Returns false if any @ doesn't start a well-formed block.
+     */
+    static bool parse(std::string_view text, std::vector<AtriumBlock>& blocks) {
+        blocks.clear();
+
+        AtriumParser parser(text);
+        for (size_t at = text.find('@'); at != std::string_view::npos; at = text.find('@', parser.it - text.data())) {
+            // Part of a word, most likely an email address
+            if (at > 0 && isNameChar(text[at - 1])) return false;
+
+            parser.it = text.data() + at;
+
+            blocks.emplace_back();
+            if (!parser.block(blocks.back())) return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Resolve backslash escapes in a value.
+     */
+    static std::string unescape(std::string_view value) {
+        std::string result;
+        result.reserve(value.size());
+
+        for (size_t i = 0; i < value.size(); ++i) {
+            char c = value[i];
+            if (c == '\\' && i + 1 < value.size()) {
+                c = value[++i];
+                if (c == 'n') c = '\n';
+                else if (c == 't') c = '\t';
+            }
+            result += c;
+        }
+
+        return result;
+    }
+
+private:
+    const char* it;
+    const char* end;
+
+    explicit AtriumParser(std::string_view text) : it(text.data()), end(text.data() + text.size()) {}
+
+    static bool isNameChar(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.';
+    }
+
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    void skipSpace() {
+        while (it < end && isSpace(*it)) ++it;
+    }
+
+    bool block(AtriumBlock& block) {
+        const char* start = it++;
+
+        const char* nameStart = it;
+        while (it < end && isNameChar(*it)) ++it;
+        if (it == nameStart) return false;
+        block.name = std::string_view(nameStart, it - nameStart);
+
+        skipSpace();
+
+        const char* attributesEnd = nullptr;
+        if (it < end && *it == '(') {
+            ++it;
+            if (!attributes(block)) return false;
+            attributesEnd = it;
+            skipSpace();
+        }
+
+        if (it < end && *it == '{') {
+            ++it;
+            if (!properties(block)) return false;
+        } else if (it < end && *it == ';') {
+            ++it;
+        } else if (it < end && isNameChar(*it) && property(block, false)) {
+            // Shorthand for a single property, which has to end with a semicolon
+        } else if (attributesEnd) {
+            // Whatever follows the attributes is text again
+            it = attributesEnd;
+        } else {
+            return false;
+        }
+
+        block.source = std::string_view(start, it - start);
+        return true;
+    }
+
+    bool attributes(AtriumBlock& block) {
+        skipSpace();
+        if (it < end && *it == ')') {
+            ++it;
+            return true;
+        }
+
+        while (it < end) {
+            AtriumAttribute attribute;
+
+            skipSpace();
+            if (!value(attribute.name, ",)[")) return false;
+
+            skipSpace();
+            if (it < end && *it == '[') {
+                ++it;
+                attribute.hasValues = true;
+                if (!list(attribute.values, ",]") || it >= end || *it != ']') return false;
+                ++it;
+                skipSpace();
+            }
+
+            if (!attribute.name.empty() || attribute.hasValues) block.attributes.push_back(std::move(attribute));
+
+            if (it >= end) return false;
+            if (*it == ')') {
+                ++it;
+                return true;
+            }
+            if (*it != ',') return false;
+            ++it;
+        }
+
+        return false;
+    }
+
+    bool properties(AtriumBlock& block) {
+        while (true) {
+            skipSpace();
+            if (it >= end) return false;
+
+            if (*it == '}') {
+                ++it;
+                return true;
+            }
+
+            if (*it == '#') {
+                while (it < end && *it != '\n') ++it;
+                continue;
+            }
+
+            if (!property(block, true)) return false;
+        }
+    }
+
+    /**
+     * key: value, value; or a flag (key;). Inside braces, the last property doesn't need the semicolon.
+     */
+    bool property(AtriumBlock& block, bool inBraces) {
+        AtriumProperty property;
+
+        const char* keyStart = it;
+        while (it < end && isNameChar(*it)) ++it;
+        if (it == keyStart) return false;
+        property.key = std::string_view(keyStart, it - keyStart);
+
+        skipSpace();
+        if (it < end && *it == ':') {
+            ++it;
+            if (!list(property.values, ",;}")) return false;
+        }
+
+        if (it < end && *it == ';') {
+            ++it;
+        } else if (!inBraces || it >= end || *it != '}') {
+            return false;
+        }
+
+        block.properties.push_back(std::move(property));
+        return true;
+    }
+
+    /**
+     * Comma separated values, stopping (without consuming) at any other character in stops.
+     */
+    bool list(std::vector<std::string_view>& values, const char* stops) {
+        while (true) {
+            skipSpace();
+
+            std::string_view item;
+            if (!value(item, stops)) return false;
+            if (!item.empty()) values.push_back(item);
+
+            skipSpace();
+            if (it < end && *it == ',') {
+                ++it;
+                continue;
+            }
+
+            return true;
+        }
+    }
+
+    /**
+     * A quoted string or everything up to one of stops, without trailing whitespace.
+     */
+    bool value(std::string_view& result, const char* stops) {
+        if (it < end && (*it == '"' || *it == '\'')) {
+            char quote = *it++;
+            const char* start = it;
+
+            while (it < end && *it != quote) {
+                if (*it == '\\' && it + 1 < end) ++it;
+                ++it;
+            }
+
+            if (it >= end) return false;
+            result = std::string_view(start, it - start);
+            ++it;
+            return true;
+        }
+
+        const char* start = it;
+        while (it < end && !std::strchr(stops, *it) && *it != '{' && *it != '(' && *it != '"' && *it != '\'') ++it;
+
+        const char* valueEnd = it;
+        while (valueEnd > start && isSpace(valueEnd[-1])) --valueEnd;
+
+        result = std::string_view(start, valueEnd - start);
+        return true;
+    }
+};
+
+
+void* empty = nullptr;
+
+// Default for HTMLParserOptions::maxFileSize
+const size_t MAX_FILE_SIZE = 10 * 1024 * 1024;
+
+
+class HTMLParserOptions {
+public:
+    // Whether to collect and store/reconstruct chunks of the code back into a buffer
+    const bool buffer;
+
+    // Minify the output (whitespace, attribute quotes/values and optional end tags), in the same pass
+    bool compact = false;
+
+    // Use vanilla HTML parsing (drop custom syntax)
+    bool vanilla = false;
+
+    // Compile <ls::template> elements into functions cloning a <template> rather than creating every node (see LsTemplateCompiler)
+    bool cloneTemplates = false;
+
+    // Callbacks record render slots instead of producing output right away (see RenderPlan)
+    bool recordSlots = false;
+
+    // With recordSlots, {{ path.to.value }} is rendered from the request data instead of left for the client (see SLOT_DATA)
+    bool ssr = false;
+
+    // Files larger than this are refused by fromFile and inlineFile
+    size_t maxFileSize = MAX_FILE_SIZE;
+
+    std::string header = "";
+    std::function<void(std::string&, std::stack<std::string_view>&, std::string_view, void*)> onText = nullptr;
+    std::function<void(std::string&, std::stack<std::string_view>&, std::string_view, void*)> onOpeningTag = nullptr;
+    std::function<void(std::string&, std::stack<std::string_view>&, std::string_view, void*)> onClosingTag = nullptr;
+    std::function<void(std::string&, std::stack<std::string_view>&, std::string_view, void*)> onInline = nullptr;
+    std::function<void(void*)> onEnd = nullptr;
+
+    // Blocks found in text (see AtriumParser), text without them never reaches onText
+    std::function<void(std::string&, std::stack<std::string_view>&, const AtriumBlock&, void*)> onBlock = nullptr;
+
+    HTMLParserOptions(bool buffer) : buffer(buffer) {
+        if(buffer) {
+            onText = _defaultOnText;
+            onOpeningTag = _defaultOnOpeningTag;
+            onClosingTag = _defaultOnClosingTag;
+            onInline = _defaultOnInline;
+        }
+    };
+
+    /**
+     * Everything that changes what the parser writes for a file, used to key the disk cache.
+     */
+    std::string cacheKey() const {
+        std::string key;
+        key += buffer? 'b': '-';
+        key += compact? 'c': '-';
+        key += vanilla? 'v': '-';
+        key += recordSlots? 'r': '-';
+        key += onText? 't': '-';
+        key += onOpeningTag? 'o': '-';
+        key += onClosingTag? 'e': '-';
+        key += onInline? 'i': '-';
+        key += onBlock? 'k': '-';
+        key += cloneTemplates? 'l': '-';
+        key += ssr? 's': '-';
+        return key;
+    }
+
+    static void _defaultOnText(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void* userData) {
+        buffer.append(value);
+    }
+
+    static void _defaultOnOpeningTag(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
+        buffer.append("<").append(tag);
+    }
+
+    static void _defaultOnClosingTag(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
+        buffer.append("</").append(tag).append(">");
+    }
+
+    static void _defaultOnInline(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void* userData) {
+        buffer.append("<span data-reactive=\"").append(value).append("\"></span>");
+    }
+};
+
+
+/*
+    Content digests
+
+    Composed documents and render plans carry an xxh3-128 digest of their bytes, computed once per version, so the
+    server can answer conditional requests (ETag / If-None-Match) without looking at the body.
+*/
+
+struct ContentDigest {
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    static ContentDigest of(std::string_view data) {
+        XXH128_hash_t hash = XXH3_128bits(data.data(), data.size());
+        return { hash.high64, hash.low64 };
+    }
+
+    std::string hex() const {
+        char buffer[33];
+        snprintf(buffer, sizeof(buffer), "%016llx%016llx", (unsigned long long) high, (unsigned long long) low);
+        return std::string(buffer, 32);
+    }
+};
+
+
+/*
+    <ls::template> compilation
+
+    The body of an <ls::template> becomes a JavaScript function returning { root, ...exports }, where {{ name }}
+    turns into an element bound with LS.Reactive and #{{ expr }} into nodes built from the data argument.
+    The body is read once into a flat list of nodes (in document order, so every subtree is contiguous),
+    from which one of two outputs is written:
+
+    - LS_TEMPLATE_DOM creates every node with createElement / createTextNode on each call.
+    - LS_TEMPLATE_CLONE writes the markup into a <template> once, and each call only clones it and looks up
+      the few nodes it needs (root, exports and bindings) by their child index. This relies on the browser
+      building the same tree from the markup, so every element has to be closed explicitly (void elements aside).
+
+    Generated functions are memoized by id, mode and a hash of the body, so pages parsed again after a change,
+    or many pages sharing the same template, skip the code generation.
+*/
+
+enum LsTemplateMode : uint8_t {
+    LS_TEMPLATE_DOM,
+    LS_TEMPLATE_CLONE
+};
+
+class LsTemplateCompiler {
+public:
+    /**
+     * Generated function for a template body, shared with every earlier compilation of the same body.
+     */
+    static std::shared_ptr<const std::string> compile(std::string_view id, std::string_view content, LsTemplateMode mode) {
+        ContentDigest digest = ContentDigest::of(content);
+
+        std::string key;
+        key.reserve(id.size() + 1 + sizeof(digest));
+        key.append(id).push_back((char) mode);
+        key.append(reinterpret_cast<const char*>(&digest), sizeof(digest));
+
+        {
+            std::lock_guard<std::mutex> lock(memoMutex);
+            auto found = memo.find(key);
+            if (found != memo.end()) return found->second;
+        }
+
+        LsTemplateCompiler compiler;
+        compiler.read(content);
+        auto code = std::make_shared<const std::string>(mode == LS_TEMPLATE_CLONE? compiler.writeClone(id): compiler.writeDOM(id));
+
+        std::lock_guard<std::mutex> lock(memoMutex);
+
+        // Live editing can produce any number of versions of a template, so rather than tracking use, start over
+        if (memo.size() >= MEMO_LIMIT) memo.clear();
+
+        memo.emplace(std::move(key), code);
+        return code;
+    }
+
+private:
+    static constexpr size_t MEMO_LIMIT = 1024;
+
+    static inline std::mutex memoMutex;
+    static inline std::unordered_map<std::string, std::shared_ptr<const std::string>> memo;
+
+    enum NodeKind : uint8_t {
+        NODE_ELEMENT,
+        NODE_TEXT,
+        NODE_REACTIVE,  // {{ name }}
+        NODE_DYNAMIC    // #{{ expr }}
+    };
+
+    struct Node {
+        NodeKind kind;
+        int parent = -1;                // Index of the parent element, -1 at the top level
+
+        // Tag name, text, reactive name or dynamic expression
+        std::string_view value;
+
+        std::string_view id = {};
+        std::string className = {};
+        std::string_view exportName = {};
+        std::vector<std::pair<std::string_view, std::string_view>> attributes = {};
+
+        uint32_t variable = 0;          // Number of its variable in the DOM output (eN)
+        uint32_t index = 0;             // Position among its siblings in the cloned markup
+        bool separated = false;         // Text right after another text, which needs a comment between them in markup
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> stack;
+    uint32_t variables = 0;
+
+    // Children counted per parent (the last one being the top level), for Node::index
+    std::vector<uint32_t> childCount { 0 };
+    std::vector<bool> endsWithText { false };
+
+    void add(Node node) {
+        size_t parent = node.parent < 0? 0: node.parent + 1;
+
+        if (node.kind == NODE_TEXT && endsWithText[parent]) {
+            node.separated = true;
+            childCount[parent]++;
+        }
+
+        node.index = childCount[parent]++;
+        endsWithText[parent] = node.kind == NODE_TEXT;
+        if (node.kind != NODE_DYNAMIC) node.variable = variables++;
+
+        nodes.push_back(std::move(node));
+        childCount.push_back(0);
+        endsWithText.push_back(false);
+    }
+
+    int parent() const {
+        return stack.empty()? -1: stack.back();
+    }
+
+    static std::string_view trim(std::string_view s) {
+        auto start = s.find_first_not_of(" \t\n\r\f\v");
+        if (start == std::string_view::npos) return {};
+        return s.substr(start, s.find_last_not_of(" \t\n\r\f\v") - start + 1);
+    }
+
+    void readTextNode(std::string_view text) {
+        for (char c : text) {
+            if (!isSpace(c)) {
+                add({ NODE_TEXT, parent(), text });
+                return;
+            }
+        }
+    }
+
+    void readText(std::string_view text) {
+        size_t p = 0;
+        while (p < text.size()) {
+            size_t open = text.find("{{", p);
+            if (open == std::string_view::npos) {
+                readTextNode(text.substr(p));
+                break;
+            }
+
+            bool hash = open > 0 && text[open - 1] == '#';
+            size_t plainEnd = hash? open - 1: open;
+            if (plainEnd > p) {
+                readTextNode(text.substr(p, plainEnd - p));
+            }
+
+            size_t close = text.find("}}", open + 2);
+            if (close == std::string_view::npos) {
+                readTextNode(text.substr(open));
+                break;
+            }
+
+            // Bindings only exist inside an element
+            if (!stack.empty()) {
+                std::string_view expression = text.substr(open + 2, close - (open + 2));
+                add({ hash? NODE_DYNAMIC: NODE_REACTIVE, parent(), hash? expression: trim(expression) });
+            }
+
+            p = close + 2;
+        }
+    }
+
+    void read(std::string_view content) {
+        auto isNameEnd = [&](size_t p) {
+            return isSpace(content[p]) || content[p] == '>' || content[p] == '/';
+        };
+
+        size_t i = 0;
+        while (i < content.size()) {
+            if (content[i] != '<') {
+                size_t next = content.find('<', i);
+                if (next == std::string_view::npos) next = content.size();
+                readText(content.substr(i, next - i));
+                i = next;
+                continue;
+            }
+
+            if (content.compare(i, 4, "<!--") == 0) {
+                size_t end = content.find("-->", i + 4);
+                i = end == std::string_view::npos? content.size(): end + 3;
+                continue;
+            }
+
+            if (i + 1 < content.size() && content[i + 1] == '/') {
+                size_t end = content.find('>', i + 2);
+                if (end == std::string_view::npos) break;
+
+                // Void elements were never opened
+                if (!stack.empty() && !(tagFlags(trim(content.substr(i + 2, end - i - 2))) & TAG_VOID)) stack.pop_back();
+                i = end + 1;
+                continue;
+            }
+
+            size_t p = i + 1;
+            while (p < content.size() && !isNameEnd(p)) ++p;
+
+            Node node { NODE_ELEMENT, parent(), content.substr(i + 1, p - i - 1) };
+            bool selfClosing = false;
+
+            while (p < content.size()) {
+                while (p < content.size() && isSpace(content[p])) ++p;
+                if (p >= content.size()) break;
+                if (content[p] == '>') { ++p; break; }
+                if (content[p] == '/' && p + 1 < content.size() && content[p + 1] == '>') {
+                    selfClosing = true;
+                    p += 2;
+                    break;
+                }
+
+                // Shorthands: .class.other and #id
+                if (content[p] == '.' || content[p] == '#') {
+                    char kind = content[p++];
+                    size_t start = p;
+                    while (p < content.size() && !isNameEnd(p)) ++p;
+
+                    if (kind == '.') {
+                        if (!node.className.empty()) node.className += ' ';
+                        size_t from = node.className.size();
+                        node.className.append(content, start, p - start);
+                        std::replace(node.className.begin() + from, node.className.end(), '.', ' ');
+                    } else {
+                        node.id = content.substr(start, p - start);
+                    }
+                    continue;
+                }
+
+                size_t nameStart = p;
+                while (p < content.size() && !isNameEnd(p) && content[p] != '=') ++p;
+                std::string_view name = content.substr(nameStart, p - nameStart);
+
+                while (p < content.size() && isSpace(content[p])) ++p;
+
+                std::string_view value;
+                if (p < content.size() && content[p] == '=') {
+                    ++p;
+                    while (p < content.size() && isSpace(content[p])) ++p;
+
+                    if (p < content.size() && (content[p] == '"' || content[p] == '\'')) {
+                        char quote = content[p++];
+                        size_t start = p;
+                        while (p < content.size() && content[p] != quote) ++p;
+                        value = content.substr(start, p - start);
+                        if (p < content.size()) ++p;
+                    } else {
+                        size_t start = p;
+                        while (p < content.size() && !isNameEnd(p)) ++p;
+                        value = content.substr(start, p - start);
+                    }
+                }
+
+                if (name == "class") {
+                    if (!node.className.empty()) node.className += ' ';
+                    node.className.append(value);
+                } else if (name == "id") {
+                    node.id = value;
+                } else if (name == "export") {
+                    node.exportName = value;
+                } else if (!name.empty()) {
+                    node.attributes.emplace_back(name, value);
+                }
+            }
+
+            bool opens = !selfClosing && !(tagFlags(node.value) & TAG_VOID);
+            add(std::move(node));
+            if (opens) stack.push_back((int) nodes.size() - 1);
+            i = p;
+        }
+    }
+
+    // Scratch for text that is escaped twice (HTML inside a JavaScript string)
+    std::string markup;
+
+    /**
+     * Text or a double-quoted attribute value in markup that is itself the body of a JavaScript string.
+     */
+    void appendMarkupJS(std::string& out, std::string_view s) {
+        markup.clear();
+        escapeHTML(s, markup);
+        escapeJSString(markup, out);
+    }
+
+    static void appendNumber(std::string& out, uint32_t number) {
+        char buffer[10];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), number);
+        out.append(buffer, result.ptr - buffer);
+    }
+
+    static void appendVariable(std::string& out, uint32_t number) {
+        out += 'e';
+        appendNumber(out, number);
+    }
+
+    static void appendExpression(std::string& out, std::string_view expression) {
+        std::string_view value = trim(expression);
+        if (value.empty()) {
+            out += "data";
+            return;
+        }
+
+        if (value.rfind("data.", 0) != 0 && value.find_first_of(".(") == std::string_view::npos) out += "data.";
+        out.append(value);
+    }
+
+    // The function ends the same in both modes: the first top-level node is the root, exported elements follow it
+    void appendReturn(std::string& out) {
+        out += "var __rootValue = ";
+
+        auto root = std::find_if(nodes.begin(), nodes.end(), [](const Node& node) { return node.parent < 0; });
+        if (root == nodes.end()) out += "null";
+        else appendVariable(out, root->variable);
+
+        out += ";\nreturn { root: __rootValue";
+        for (const Node& node : nodes) {
+            if (node.kind != NODE_ELEMENT || node.exportName.empty()) continue;
+            out.append(", ").append(node.exportName).append(": ");
+            appendVariable(out, node.variable);
+        }
+        out += " };\n}\n";
+    }
+
+    std::string writeDOM(std::string_view id) {
+        std::string out;
+        out.reserve(64 + nodes.size() * 64);
+        out.append("function ").append(id).append("(data){\n");
+
+        for (const Node& node : nodes) {
+            switch (node.kind) {
+                case NODE_DYNAMIC:
+                    appendVariable(out, nodes[node.parent].variable);
+                    out += ".appendChild(LS.__dynamicInnerToNode(";
+                    appendExpression(out, node.value);
+                    out += "));\n";
+                    continue;
+
+                case NODE_TEXT:
+                    out += "var ";
+                    appendVariable(out, node.variable);
+                    out += "=document.createTextNode(\"";
+                    escapeJSString(node.value, out);
+                    out += "\");\n";
+                    break;
+
+                case NODE_REACTIVE:
+                    out += "var ";
+                    appendVariable(out, node.variable);
+                    out += "=document.createElement(\"span\");\nLS.Reactive.bindElement(";
+                    appendVariable(out, node.variable);
+                    out += ", \"";
+                    escapeJSString(node.value, out);
+                    out += "\");\n";
+                    break;
+
+                case NODE_ELEMENT:
+                    out += "var ";
+                    appendVariable(out, node.variable);
+                    out += "=document.createElement(\"";
+                    escapeJSString(node.value, out);
+                    out += "\");";
+
+                    if (!node.id.empty()) {
+                        appendVariable(out, node.variable);
+                        out += ".id=\"";
+                        escapeJSString(node.id, out);
+                        out += "\";";
+                    }
+
+                    if (!node.className.empty()) {
+                        appendVariable(out, node.variable);
+                        out += ".className=\"";
+                        escapeJSString(node.className, out);
+                        out += "\";";
+                    }
+
+                    for (const auto& [name, value] : node.attributes) {
+                        appendVariable(out, node.variable);
+                        out += ".setAttribute(\"";
+                        escapeJSString(name, out);
+                        out += "\", \"";
+                        escapeJSString(value, out);
+                        out += "\");";
+                    }
+                    break;
+            }
+
+            if (node.parent >= 0) {
+                appendVariable(out, nodes[node.parent].variable);
+                out += ".appendChild(";
+                appendVariable(out, node.variable);
+                out += ");\n";
+            }
+        }
+
+        appendReturn(out);
+        return out;
+    }
+
+    std::string writeClone(std::string_view id) {
+        std::string out;
+        out.reserve(128 + nodes.size() * 48);
+
+        // The markup, as a JavaScript string
+        out.append("var __lsTemplate_").append(id).append("=document.createElement(\"template\");__lsTemplate_").append(id).append(".innerHTML=\"");
+
+        std::vector<int> open;
+        auto closeUntil = [&](int parent) {
+            while (!open.empty() && open.back() != parent) {
+                const Node& element = nodes[open.back()];
+                if (!(tagFlags(element.value) & TAG_VOID)) {
+                    out += "<\\/";
+                    escapeJSString(element.value, out);
+                    out += '>';
+                }
+                open.pop_back();
+            }
+        };
+
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const Node& node = nodes[i];
+            closeUntil(node.parent);
+
+            switch (node.kind) {
+                case NODE_TEXT:
+                    if (node.separated) out += "<!---->";
+                    appendMarkupJS(out, node.value);
+                    break;
+
+                case NODE_REACTIVE:
+                    out += "<span><\\/span>";
+                    break;
+
+                case NODE_DYNAMIC:
+                    out += "<!---->";
+                    break;
+
+                case NODE_ELEMENT:
+                    out += '<';
+                    escapeJSString(node.value, out);
+
+                    if (!node.id.empty()) {
+                        out += " id=\\\"";
+                        appendMarkupJS(out, node.id);
+                        out += "\\\"";
+                    }
+
+                    if (!node.className.empty()) {
+                        out += " class=\\\"";
+                        appendMarkupJS(out, node.className);
+                        out += "\\\"";
+                    }
+
+                    for (const auto& [name, value] : node.attributes) {
+                        out += ' ';
+                        escapeJSString(name, out);
+                        out += "=\\\"";
+                        appendMarkupJS(out, value);
+                        out += "\\\"";
+                    }
+
+                    out += '>';
+                    open.push_back((int) i);
+                    break;
+            }
+        }
+
+        closeUntil(-1);
+        out += "\";\n";
+
+        // Only nodes the function touches get a variable, along with their ancestors to reach them
+        std::vector<bool> used(nodes.size(), false);
+        bool hasRoot = false;
+
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            Node& node = nodes[i];
+            if (node.kind == NODE_DYNAMIC) node.variable = variables++;
+            if (node.parent < 0 && !hasRoot) used[i] = hasRoot = true;
+            if (node.kind == NODE_REACTIVE || node.kind == NODE_DYNAMIC || !node.exportName.empty()) used[i] = true;
+        }
+
+        for (size_t i = nodes.size(); i-- > 0;) {
+            if (used[i] && nodes[i].parent >= 0) used[nodes[i].parent] = true;
+        }
+
+        out.append("function ").append(id).append("(data){\nvar f=__lsTemplate_").append(id).append(".content.cloneNode(true);\n");
+
+        // Look everything up before bindings replace any node, so child indices stay valid
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (!used[i]) continue;
+            const Node& node = nodes[i];
+
+            out += "var ";
+            appendVariable(out, node.variable);
+            out += '=';
+            if (node.parent < 0) out += 'f';
+            else appendVariable(out, nodes[node.parent].variable);
+            out += ".childNodes[";
+            appendNumber(out, node.index);
+            out += "];\n";
+        }
+
+        for (const Node& node : nodes) {
+            if (node.kind == NODE_REACTIVE) {
+                out += "LS.Reactive.bindElement(";
+                appendVariable(out, node.variable);
+                out += ", \"";
+                escapeJSString(node.value, out);
+                out += "\");\n";
+            } else if (node.kind == NODE_DYNAMIC) {
+                appendVariable(out, node.variable);
+                out += ".replaceWith(LS.__dynamicInnerToNode(";
+                appendExpression(out, node.value);
+                out += "));\n";
+            }
+        }
+
+        appendReturn(out);
+        return out;
+    }
+};
+
+
+/*
+    Render plans
+
+    Only a few parts of a page really need JavaScript (blocks, inline scripts/styles, custom callbacks).
+    When parsing with recordSlots enabled, those parts are not evaluated - instead, the parser records a typed slot
+    at the current output position. A page (composed with its template) then becomes a RenderPlan: static bytes
+    with slots in between, which can be rendered over and over without touching the tokenizer.
+*/
+
+enum RenderSlotType : uint8_t {
+    SLOT_TEXT,
+    SLOT_OPENING_TAG,
+    SLOT_CLOSING_TAG,
+    SLOT_INLINE,
+    SLOT_BODY_ATTRIBUTES,
+
+    // {{ path }} in ssr mode, resolved against the request data and HTML-escaped, no JS involved
+    SLOT_DATA,
+
+    // An Atrium block, its value is the block source (parsed again when rendered)
+    SLOT_BLOCK
+};
+
+struct RenderSlot {
+    RenderSlotType type;
+
+    // Position in the output where the result of the slot belongs
+    size_t offset;
+
+    std::string value;
+
+    // Tag on top of the stack when the slot was recorded
+    std::string parent;
+};
+
+struct RenderPlan {
+    std::string statics;
+
+    // Sorted by offset
+    std::vector<RenderSlot> slots;
+
+    std::string header;
+    uint64_t templateRevision = 0;
+
+    // Digest of statics - the whole output when there are no slots
+    ContentDigest digest;
+
+    // All slot values and parents in one string, for dispatching every slot with a single call.
+    // 5 numbers per slot: type, value offset, value length, parent offset, parent length - counted in UTF-16 units, like JS strings.
+    std::string batchSource;
+    std::vector<uint32_t> batchEvents;
+
+    // Slots that go through onBatch - data, block and body attribute slots are rendered by the binding itself
+    size_t scriptSlots = 0;
+
+    // SLOT_DATA slots - with any, the output depends on the request and can't be cached as a whole
+    size_t dataSlots = 0;
+
+    // Size of the last render, so the next one can reserve its output once (slot output varies little between requests)
+    mutable std::atomic<size_t> renderedSize { 0 };
+
+    /**
+     * How much to reserve for the next render.
+     */
+    size_t expectedSize() const {
+        size_t last = renderedSize.load(std::memory_order_relaxed);
+        return last? last + last / 16: statics.size() + slots.size() * 64;
+    }
+
+    /**
+     * Append the statics to output, with renderSlot(slot, output) filling in every slot. Stops if it returns false.
+     */
+    template <typename SlotRenderer>
+    bool render(std::string& output, SlotRenderer&& renderSlot) const {
+        size_t position = 0;
+        for (const RenderSlot& slot : slots) {
+            output.append(statics, position, slot.offset - position);
+            position = slot.offset;
+
+            if (!renderSlot(slot, output)) return false;
+        }
+
+        output.append(statics, position, std::string::npos);
+        return true;
+    }
+};
+
+/**
+ * Length of UTF-8 text in UTF-16 code units.
+ */
+inline size_t utf16Length(std::string_view text) {
+    size_t length = 0;
+    for (unsigned char c : text) {
+        // Continuation bytes don't start a new character, 4-byte sequences become surrogate pairs
+        if ((c & 0xC0) != 0x80) length++;
+        if (c >= 0xF0) length++;
+    }
+    return length;
+}
+
+
+/*
+    Server-side rendering of inline values
+
+    Without ssr, {{ value }} becomes an empty reactive marker that the client fills in on load. With it, plain paths
+    (user.name, items.0.title) become SLOT_DATA slots inside the marker, walked through the data object of each request
+    and HTML-escaped when the plan renders - the marker itself stays in the statics, so the client keeps updating it.
+    Anything that isn't a plain path (expressions, calls) is still left for the client.
+*/
+
+/**
+ * Whether an inline value is a dotted path that can be resolved without evaluating it.
+ */
+inline bool isDataPath(std::string_view path) {
+    if (path.empty() || path.front() == '.' || path.back() == '.') return false;
+
+    char previous = 0;
+    for (char c : path) {
+        bool identifier = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$';
+        if (!identifier && (c != '.' || previous == '.')) return false;
+        previous = c;
+    }
+    return true;
+}
+
+/**
+ * Walk a path (see isDataPath) from node, one segment at a time.
+ * lookup(node, key) moves node to its child and returns false if there is none.
+ */
+template <typename Node, typename Lookup>
+bool resolveDataPath(std::string_view path, Node& node, Lookup&& lookup) {
+    size_t start = 0;
+    while (true) {
+        size_t dot = path.find('.', start);
+        if (!lookup(node, path.substr(start, dot == std::string_view::npos? std::string_view::npos: dot - start))) return false;
+        if (dot == std::string_view::npos) return true;
+        start = dot + 1;
+    }
+}
+
+
+/*
+    File watcher
+
+    Cache entries remember which files they were built from. On Linux, a background thread listens to inotify events
+    on the directories of those files and bumps a version counter on every change, so checking whether an entry is
+    still up to date is just a few memory reads. Elsewhere (or if a file can't be watched) checks fall back to
+    comparing modification times.
+*/
+
+struct FileWatch {
+    // Incremented every time the file changes
+    std::atomic<uint64_t> version { 0 };
+};
+
+class FileWatcher {
+public:
+    static FileWatcher& instance() {
+        // Never destroyed, the thread lives as long as the process
+        static FileWatcher* watcher = new FileWatcher();
+        return *watcher;
+    }
+
+    bool active() const {
+        return fd >= 0;
+    }
+
+    /**
+     * Incremented whenever anything in the watched directories changes - if it didn't move, no watched file changed.
+     */
+    uint64_t generation() const {
+        return generation_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Start tracking a file. Returns nullptr if it can't be watched.
+     */
+    std::shared_ptr<FileWatch> watch(const std::string& path) {
+        if (!active()) return nullptr;
+
+        std::string key = std::filesystem::path(path).lexically_normal().string();
+        std::string directory = directoryOf(key);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+#ifdef __linux__
+        if (directoryWatches.find(directory) == directoryWatches.end()) {
+            int wd = inotify_add_watch(fd, directory.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+            if (wd < 0) return nullptr;
+
+            directoryWatches[directory] = wd;
+            directories[wd] = directory;
+        }
+#endif
+
+        auto& file = files[key];
+        if (!file) file = std::make_shared<FileWatch>();
+        return file;
+    }
+
+    /**
+     * Current version of a tracked file, or -1 if it isn't tracked.
+     */
+    int64_t version(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto file = files.find(std::filesystem::path(path).lexically_normal().string());
+        return file == files.end()? -1: (int64_t) file->second->version.load(std::memory_order_acquire);
+    }
+
+private:
+    int fd = -1;
+    std::mutex mutex;
+    std::atomic<uint64_t> generation_ { 0 };
+
+    std::unordered_map<int, std::string> directories;
+    std::unordered_map<std::string, int> directoryWatches;
+    std::unordered_map<std::string, std::shared_ptr<FileWatch>> files;
+
+    FileWatcher() {
+#ifdef __linux__
+        fd = inotify_init1(IN_CLOEXEC);
+        if (fd >= 0) {
+            std::thread(&FileWatcher::run, this).detach();
+        }
+#endif
+    }
+
+    static std::string directoryOf(const std::string& path) {
+        std::string directory = std::filesystem::path(path).parent_path().string();
+        return directory.empty()? ".": directory;
+    }
+
+    void touchDirectory(const std::string& directory) {
+        for (auto& [path, file] : files) {
+            if (directoryOf(path) == directory) {
+                file->version.fetch_add(1, std::memory_order_release);
+            }
+        }
+    }
+
+#ifdef __linux__
+    void run() {
+        alignas(struct inotify_event) char buffer[16384];
+
+        while (true) {
+            ssize_t length = read(fd, buffer, sizeof(buffer));
+            if (length <= 0) {
+                if (length < 0 && errno == EINTR) continue;
+                break;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            for (char* event_it = buffer; event_it < buffer + length; ) {
+                const auto* event = reinterpret_cast<const struct inotify_event*>(event_it);
+                event_it += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // Lost track of what happened, consider everything changed
+                    for (auto& [path, file] : files) {
+                        file->version.fetch_add(1, std::memory_order_release);
+                    }
+                    continue;
+                }
+
+                auto directory = directories.find(event->wd);
+                if (directory == directories.end()) continue;
+
+                if (event->mask & IN_IGNORED) {
+                    // Watch is gone, it gets added again the next time a file from this directory is tracked
+                    touchDirectory(directory->second);
+                    directoryWatches.erase(directory->second);
+                    directories.erase(directory);
+                    continue;
+                }
+
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    touchDirectory(directory->second);
+                    if (event->mask & IN_MOVE_SELF) inotify_rm_watch(fd, event->wd);
+                    continue;
+                }
+
+                if (event->len == 0) continue;
+
+                auto file = files.find((std::filesystem::path(directory->second) / event->name).lexically_normal().string());
+                if (file != files.end()) {
+                    file->second->version.fetch_add(1, std::memory_order_release);
+                }
+            }
+
+            generation_.fetch_add(1, std::memory_order_release);
+        }
+    }
+#endif
+};
+
+struct FileDependency {
+    std::string path;
+
+    // nullptr if the file isn't watched, lastModified is compared instead
+    std::shared_ptr<FileWatch> watch;
+    uint64_t version = 0;
+    std::filesystem::file_time_type lastModified;
+
+    /**
+     * Snapshot the current state of a file - should be taken before reading it, so changes made while reading are not missed.
+     */
+    static FileDependency track(const std::string& path) {
+        FileDependency dependency;
+        dependency.path = path;
+        dependency.watch = FileWatcher::instance().watch(path);
+
+        if (dependency.watch) {
+            dependency.version = dependency.watch->version.load(std::memory_order_acquire);
+        } else {
+            std::error_code error;
+            dependency.lastModified = std::filesystem::last_write_time(path, error);
+        }
+
+        return dependency;
+    }
+
+    bool changed() const {
+        if (watch) {
+            return watch->version.load(std::memory_order_acquire) != version;
+        }
+
+        std::error_code error;
+        auto modified = std::filesystem::last_write_time(path, error);
+        return error || modified != lastModified;
+    }
+};
+
+/*
+    Source files
+
+    Large files are memory-mapped read-only (with a sequential access hint) and parsed straight from the page cache,
+    without copying them into the heap first. Smaller ones are read into a buffer: the copy costs next to nothing at that
+    size, and a mapping faults (SIGBUS) if the file is truncated while it is being parsed - so files above MMAP_THRESHOLD
+    should be replaced (renamed over) rather than rewritten in place.
+    Sources are shared by everything that reads the same file and are kept by cache entries, so re-parsing a file that
+    didn't change doesn't read it again.
+*/
+
+class SourceFile {
+public:
+    // State of the file at the time it was loaded
+    FileDependency dependency;
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    ~SourceFile() {
+        // Nothing uses this version of the file anymore (eg. its cache entry was evicted or it changed), forget it
+        {
+            Registry& registry = SourceFile::registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            auto loadedIt = registry.loaded.find(dependency.path);
+            if (loadedIt != registry.loaded.end() && loadedIt->second.expired()) registry.loaded.erase(loadedIt);
+        }
+
+#ifdef XPARSER_MMAP
+        if (mapped) munmap(const_cast<char*>(data), size);
+#endif
+    }
+
+    std::string_view view() const {
+        return std::string_view(data, size);
+    }
+
+    /**
+     * Get the contents of a file, reusing an existing mapping if the file didn't change since.
+     */
+    static std::shared_ptr<const SourceFile> load(const std::string& path, size_t maxSize) {
+        Registry& registry = SourceFile::registry();
+
+        // An outdated source may be the last reference, it has to be released without holding the lock (see ~SourceFile)
+        std::shared_ptr<const SourceFile> outdated;
+
+        {
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            auto loadedIt = registry.loaded.find(path);
+            if (loadedIt != registry.loaded.end()) {
+                outdated = loadedIt->second.lock();
+                if (outdated && outdated->size <= maxSize && !outdated->dependency.changed()) {
+                    return outdated;
+                }
+            }
+        }
+
+        // Taken before reading, so a change made while reading is not missed
+        std::shared_ptr<SourceFile> source(new SourceFile(FileDependency::track(path)));
+        source->read(path, maxSize);
+
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.loaded[path] = source;
+        return source;
+    }
+
+private:
+    // Files smaller than this are read into memory instead of mapped
+    static constexpr size_t MMAP_THRESHOLD = 1024 * 1024;
+
+    const char* data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+
+    // Used for small and empty files and where mmap is not available
+    std::string fallback;
+
+    // Sources currently in use by path, entries are removed as their source is destroyed
+    struct Registry {
+        std::unordered_map<std::string, std::weak_ptr<const SourceFile>> loaded;
+        std::mutex mutex;
+    };
+
+    static Registry& registry() {
+        // Never destroyed, sources held by static caches may outlive it otherwise
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+
+    SourceFile(FileDependency dependency) : dependency(std::move(dependency)) {}
+
+    static std::runtime_error tooLarge(size_t maxSize) {
+        return std::runtime_error("File size exceeds the maximum limit of " + std::to_string(maxSize) + " bytes.");
+    }
+
+    void read(const std::string& path, size_t maxSize) {
+#ifdef XPARSER_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Unable to open file: " + path);
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Error reading file: " + path);
+        }
+
+        if ((size_t) info.st_size > maxSize) {
+            ::close(fd);
+            throw tooLarge(maxSize);
+        }
+
+        if ((size_t) info.st_size >= MMAP_THRESHOLD) {
+            void* region = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+
+            if (region == MAP_FAILED) {
+                throw std::runtime_error("Error reading file: " + path);
+            }
+
+            madvise(region, info.st_size, MADV_SEQUENTIAL);
+
+            data = static_cast<const char*>(region);
+            size = info.st_size;
+            mapped = true;
+            return;
+        }
+
+        // Stops early if the file shrinks meanwhile, what was read until then is parsed
+        fallback.resize(info.st_size);
+        size_t length = 0;
+        while (length < fallback.size()) {
+            ssize_t count = ::read(fd, fallback.data() + length, fallback.size() - length);
+            if (count < 0 && errno == EINTR) continue;
+
+            if (count < 0) {
+                ::close(fd);
+                throw std::runtime_error("Error reading file: " + path);
+            }
+
+            if (count == 0) break;
+            length += count;
+        }
+
+        fallback.resize(length);
+        ::close(fd);
+#else
+        std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file.is_open()) {
+            throw std::runtime_error("Unable to open file: " + path);
+        }
+
+        std::streamsize length = file.tellg();
+        if ((size_t) length > maxSize) {
+            throw tooLarge(maxSize);
+        }
+
+        fallback.resize(length);
+        file.seekg(0, std::ios::beg);
+        if (length > 0 && !file.read(fallback.data(), length)) {
+            throw std::runtime_error("Error reading file: " + path);
+        }
+#endif
+
+        data = fallback.data();
+        size = fallback.size();
+    }
+};
+
+// Every parse gets a new revision, so entries can tell whether their template was re-parsed since
+static std::atomic<uint64_t> nextRevision { 1 };
+
+
+struct FileCache {
+    std::filesystem::file_time_type lastModified;
+    size_t templateChunkSplit = 0;
+    std::string path;
+    std::string content;
+
+    // Functions compiled from <ls::template> elements (as a <script>), composed in front of the content
+    std::string script;
+
+    // Render slots recorded in content (only when parsed with recordSlots) and the composed plan
+    std::vector<RenderSlot> slots;
+    size_t templateChunkSplitSlot = 0;
+    std::shared_ptr<const RenderPlan> plan = nullptr;
+
+    // Where <head> and </head> were written to content, recorded while parsing
+    size_t headOpen = std::string::npos;
+    size_t headClose = std::string::npos;
+
+    // Composed document (header, template and content), reused until any of them changes
+    std::shared_ptr<const std::string> composed = nullptr;
+    std::string composedHeader;
+    uint64_t composedTemplateRevision = 0;
+    ContentDigest composedDigest;
+
+    // Copy of the content used as a shared compression dictionary by pages using this entry as their template
+    std::shared_ptr<const std::string> dictionary = nullptr;
+    ContentDigest dictionaryDigest;
+
+    // Files the content was built from (the file itself and anything it imported)
+    std::vector<FileDependency> dependencies;
+
+    // Mapped sources of the last parse (the file and its imports), kept so unchanged files don't need to be read again
+    std::vector<std::shared_ptr<const SourceFile>> sources;
+    uint64_t revision = 0;
+
+    // FIXME: Would be safer to use path
+    std::shared_ptr<FileCache> templateCache = nullptr;
+    uint64_t templateRevision = 0;
+
+    // Bytes accounted for this entry in its FileCacheStore
+    size_t charged = 0;
+
+    FileCache() = default;
+
+    FileCache(const std::string& path, std::filesystem::file_time_type lastModified)
+        : path(path), lastModified(lastModified), templateCache(nullptr) {}
+
+    FileCache(const std::string& path, const std::string& content, std::filesystem::file_time_type lastModified)
+        : path(path), content(content), lastModified(lastModified), templateCache(nullptr) {}
+
+    bool operator==(const FileCache& other) const {
+        return path == other.path;
+    }
+
+    /**
+     * Whether any of the files the content was built from changed since it was parsed.
+     */
+    bool changed() const {
+        for (const auto& dependency : dependencies) {
+            if (dependency.changed()) return true;
+        }
+        return false;
+    }
+
+    /**
+     * Whether the entry or its template need to be parsed again.
+     */
+    bool outdated() const {
+        if (changed()) return true;
+        return templateCache && (templateCache->changed() || templateCache->revision != templateRevision);
+    }
+
+    /**
+     * Heap memory owned by the entry (mapped sources are not counted, the kernel can reclaim those).
+     */
+    size_t memoryUsage() const {
+        size_t bytes = sizeof(FileCache) + path.capacity() + content.capacity() + script.capacity();
+
+        for (const auto& slot : slots) {
+            bytes += sizeof(RenderSlot) + slot.value.capacity() + slot.parent.capacity();
+        }
+
+        if (composed) {
+            bytes += composed->capacity();
+        }
+
+        if (dictionary) {
+            bytes += dictionary->capacity();
+        }
+
+        if (plan) {
+            bytes += sizeof(RenderPlan) + plan->statics.capacity() + plan->batchSource.capacity() + plan->batchEvents.capacity() * sizeof(uint32_t);
+            for (const auto& slot : plan->slots) {
+                bytes += sizeof(RenderSlot) + slot.value.capacity() + slot.parent.capacity();
+            }
+        }
+
+        return bytes;
+    }
+};
+
+
+/*
+    Disk cache
+
+    Keeps parsed entries across restarts. Every entry is one file in the cache directory, named after the source path,
+    root path and parser options, and holds the xxh3 hash of the source it was parsed from - an entry is only used if
+    the source still hashes the same and every file it imported still has the same modification time.
+    The file is a flat binary image (header, content, script, template path, slots, dependencies) read straight from a mapping.
+
+    Only entries parsed without JavaScript (recordSlots) are stored, everything else would bake in JS output.
+*/
+
+// Bump whenever the format or the parser output changes, so old entries are ignored
+const uint32_t DISK_CACHE_VERSION = 6;
+
+struct DiskCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+
+    uint64_t contentSize;
+    uint64_t scriptSize;
+    uint64_t templateChunkSplit;
+    uint64_t templateChunkSplitSlot;
+    uint64_t headOpen;
+    uint64_t headClose;
+
+    uint32_t templatePathSize;
+    uint32_t slotCount;
+    uint32_t dependencyCount;
+    uint32_t reserved;
+};
+
+struct DiskCacheSlot {
+    uint64_t offset;
+    uint32_t valueSize;
+    uint32_t parentSize;
+    uint8_t type;
+    uint8_t reserved[7];
+};
+
+struct DiskCacheDependency {
+    int64_t lastModified;
+    uint32_t pathSize;
+    uint32_t reserved;
+};
+
+struct DiskCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t writes = 0;
+};
+
+class DiskCache {
+public:
+    /**
+     * Start using a directory (created if missing). An empty path disables the cache.
+     */
+    bool open(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        directory.clear();
+        if (path.empty()) return true;
+
+        std::error_code error;
+        std::filesystem::create_directories(path, error);
+        if (error) return false;
+
+        directory = path;
+        return true;
+    }
+
+    bool enabled() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !directory.empty();
+    }
+
+    /**
+     * Key for a file parsed with some options - names the file the entry is stored in.
+     */
+    static uint64_t key(const std::string& path, const std::string& rootPath, const std::string& options) {
+        std::string input;
+        input.reserve(path.size() + rootPath.size() + options.size() + 2);
+        input.append(path).append(1, '\0').append(rootPath).append(1, '\0').append(options);
+        return XXH3_64bits(input.data(), input.size());
+    }
+
+    static uint64_t hash(std::string_view source) {
+        return XXH3_64bits(source.data(), source.size());
+    }
+
+    /**
+     * Fill an entry from the disk, if a valid one exists. templatePath receives the template the entry used, if any.
+     */
+    bool load(uint64_t key, uint64_t sourceHash, FileCache& entry, std::string& templatePath) {
+        std::string file = pathOf(key);
+        if (file.empty()) return false;
+
+#ifdef XPARSER_MMAP
+        int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return miss();
+
+        struct stat info;
+        void* mapping = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            mapping = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+
+        if (mapping == MAP_FAILED) return miss();
+
+        bool loaded = read(std::string_view(static_cast<const char*>(mapping), (size_t) info.st_size), sourceHash, entry, templatePath);
+        munmap(mapping, (size_t) info.st_size);
+#else
+        std::ifstream stream(file, std::ios::binary);
+        if (!stream) return miss();
+
+        std::string data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        bool loaded = read(data, sourceHash, entry, templatePath);
+#endif
+
+        if (!loaded) return miss();
+
+        stats_.hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * Write an entry to the disk. The file is replaced atomically, so readers never see a partial entry.
+     */
+    void store(uint64_t key, uint64_t sourceHash, const FileCache& entry, const std::string& templatePath) {
+        std::string file = pathOf(key);
+        if (file.empty()) return;
+
+        DiskCacheHeader header {};
+        std::memcpy(header.magic, "XPC\0", 4);
+        header.version = DISK_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.contentSize = entry.content.size();
+        header.scriptSize = entry.script.size();
+        header.templateChunkSplit = entry.templateChunkSplit;
+        header.templateChunkSplitSlot = entry.templateChunkSplitSlot;
+        header.headOpen = entry.headOpen;
+        header.headClose = entry.headClose;
+        header.templatePathSize = (uint32_t) templatePath.size();
+        header.slotCount = (uint32_t) entry.slots.size();
+        header.dependencyCount = (uint32_t) entry.dependencies.size();
+
+        std::string image;
+        image.reserve(sizeof(header) + entry.content.size() + entry.script.size() + templatePath.size() + entry.slots.size() * (sizeof(DiskCacheSlot) + 32));
+
+        append(image, header);
+        image.append(entry.content);
+        image.append(entry.script);
+        image.append(templatePath);
+
+        for (const auto& slot : entry.slots) {
+            DiskCacheSlot record {};
+            record.offset = slot.offset;
+            record.valueSize = (uint32_t) slot.value.size();
+            record.parentSize = (uint32_t) slot.parent.size();
+            record.type = slot.type;
+
+            append(image, record);
+            image.append(slot.value);
+            image.append(slot.parent);
+        }
+
+        for (const auto& dependency : entry.dependencies) {
+            std::error_code error;
+            auto lastModified = std::filesystem::last_write_time(dependency.path, error);
+            if (error) return;
+
+            DiskCacheDependency record {};
+            record.lastModified = (int64_t) lastModified.time_since_epoch().count();
+            record.pathSize = (uint32_t) dependency.path.size();
+
+            append(image, record);
+            image.append(dependency.path);
+        }
+
+        // Unique per thread, entries for the same file are never written by two threads at once
+        std::string temporary = file + ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+        {
+            std::ofstream stream(temporary, std::ios::binary | std::ios::trunc);
+            if (!stream) return;
+            stream.write(image.data(), image.size());
+            if (!stream) {
+                stream.close();
+                std::remove(temporary.c_str());
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporary, file, error);
+        if (error) {
+            std::remove(temporary.c_str());
+            return;
+        }
+
+        stats_.writes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    DiskCacheStats stats() const {
+        DiskCacheStats result;
+        result.hits = stats_.hits.load(std::memory_order_relaxed);
+        result.misses = stats_.misses.load(std::memory_order_relaxed);
+        result.writes = stats_.writes.load(std::memory_order_relaxed);
+        return result;
+    }
+
+private:
+    std::mutex mutex;
+    std::string directory;
+
+    struct {
+        std::atomic<uint64_t> hits { 0 };
+        std::atomic<uint64_t> misses { 0 };
+        std::atomic<uint64_t> writes { 0 };
+    } stats_;
+
+    std::string pathOf(uint64_t key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (directory.empty()) return "";
+
+        char name[24];
+        snprintf(name, sizeof(name), "%016llx.xpc", (unsigned long long) key);
+        return directory + "/" + name;
+    }
+
+    bool miss() {
+        stats_.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    template <typename T>
+    static void append(std::string& image, const T& value) {
+        image.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    // Reads the next record or string, fails if the image is too short
+    struct Reader {
+        std::string_view image;
+        size_t position = 0;
+
+        template <typename T>
+        bool next(T& value) {
+            if (image.size() - position < sizeof(T)) return false;
+            std::memcpy(&value, image.data() + position, sizeof(T));
+            position += sizeof(T);
+            return true;
+        }
+
+        bool next(std::string& value, size_t size) {
+            if (image.size() - position < size) return false;
+            value.assign(image.data() + position, size);
+            position += size;
+            return true;
+        }
+    };
+
+    static bool read(std::string_view image, uint64_t sourceHash, FileCache& entry, std::string& templatePath) {
+        Reader reader { image };
+
+        DiskCacheHeader header;
+        if (!reader.next(header)) return false;
+        if (std::memcmp(header.magic, "XPC\0", 4) != 0 || header.version != DISK_CACHE_VERSION || header.sourceHash != sourceHash) return false;
+
+        std::string content, script;
+        if (!reader.next(content, header.contentSize) || !reader.next(script, header.scriptSize) || !reader.next(templatePath, header.templatePathSize)) return false;
+
+        std::vector<RenderSlot> slots;
+        slots.reserve(header.slotCount);
+
+        for (uint32_t i = 0; i < header.slotCount; i++) {
+            DiskCacheSlot record;
+            RenderSlot slot;
+
+            if (!reader.next(record) || !reader.next(slot.value, record.valueSize) || !reader.next(slot.parent, record.parentSize)) return false;
+            if (record.offset > content.size() || record.type > SLOT_BLOCK) return false;
+
+            slot.type = (RenderSlotType) record.type;
+            slot.offset = record.offset;
+            slots.push_back(std::move(slot));
+        }
+
+        // The first dependency is the file itself, which is checked by its hash
+        std::vector<FileDependency> dependencies;
+
+        for (uint32_t i = 0; i < header.dependencyCount; i++) {
+            DiskCacheDependency record;
+            std::string path;
+
+            if (!reader.next(record) || !reader.next(path, record.pathSize)) return false;
+            if (i == 0) continue;
+
+            // Snapshot before comparing, so a change right after the check is still noticed later
+            FileDependency dependency = FileDependency::track(path);
+
+            std::error_code error;
+            auto lastModified = std::filesystem::last_write_time(path, error);
+            if (error || (int64_t) lastModified.time_since_epoch().count() != record.lastModified) return false;
+
+            dependencies.push_back(std::move(dependency));
+        }
+
+        entry.content = std::move(content);
+        entry.script = std::move(script);
+        entry.slots = std::move(slots);
+        entry.templateChunkSplit = header.templateChunkSplit;
+        entry.templateChunkSplitSlot = header.templateChunkSplitSlot;
+        entry.headOpen = header.headOpen;
+        entry.headClose = header.headClose;
+
+        for (auto& dependency : dependencies) {
+            entry.dependencies.push_back(std::move(dependency));
+        }
+
+        return true;
+    }
+};
+
+// Global disk cache, disabled until it is given a directory
+static DiskCache diskCache;
+
+
+struct HTMLParsingPosition {
+    // std::shared_ptr<std::vector<char>> buffer = nullptr;
+    const char* it;
+    const char* chunk_end;
+    const char* value_start;
+    std::string* output;
+    std::shared_ptr<FileCache> cacheEntry;
+
+    HTMLParsingPosition() 
+        : it(nullptr), chunk_end(nullptr), value_start(nullptr), output(nullptr), cacheEntry(nullptr) {}
+
+    HTMLParsingPosition(const char* it, const char* chunk_end, const char* value_start, std::string* output = nullptr, std::shared_ptr<FileCache> cacheEntry = nullptr) 
+        : it(it), chunk_end(chunk_end), value_start(value_start), output(output), cacheEntry(std::move(cacheEntry)) {}
+};
+
+
+/*
+    File cache store
+
+    Parsed files are kept in a least-recently-used list with a memory budget. When the budget is exceeded, entries
+    are dropped starting from the least recently used one - except for pinned entries, which are still referenced
+    from elsewhere (eg. a template used by a cached page, or the entry a parse is working with).
+*/
+
+// Default for FileCacheStore::setBudget
+const size_t DEFAULT_CACHE_BUDGET = 256 * 1024 * 1024;
+
+struct FileCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t residentBytes = 0;
+    size_t budget = 0;
 };
 
-// Elements that only contain text content
-std::unordered_set<std::string> rawElements = {
-    "script", "style", "xmp", "textarea", "title"
-};
+class FileCacheStore {
+public:
+    FileCacheStore(size_t budget = DEFAULT_CACHE_BUDGET) : budget(budget) {}
+
+    // Where parsed entries are persisted across restarts, if anywhere (can be set while other threads parse)
+    std::atomic<DiskCache*> disk { nullptr };
+
+    /**
+     * Look up an entry and mark it as recently used. Returns nullptr if it is not cached.
+     */
+    std::shared_ptr<FileCache> find(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto found = entries.find(path);
+        if (found == entries.end()) return nullptr;
+
+        order.splice(order.begin(), order, found->second.position);
+        return found->second.entry;
+    }
+
+    /**
+     * Insert an entry unless one with the same path exists. Returns the cached entry and whether it was inserted.
+     */
+    std::pair<std::shared_ptr<FileCache>, bool> emplace(const std::string& path, std::shared_ptr<FileCache> entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto found = entries.find(path);
+        if (found != entries.end()) {
+            order.splice(order.begin(), order, found->second.position);
+            return { found->second.entry, false };
+        }
+
+        order.push_front(path);
+        entries.emplace(path, Slot { entry, order.begin() });
+        return { std::move(entry), true };
+    }
+
+    /**
+     * Measure an entry again after it changed, evicting other entries if the budget is exceeded.
+     */
+    void charge(const std::shared_ptr<FileCache>& entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto found = entries.find(entry->path);
+        if (found == entries.end() || found->second.entry != entry) return;
+
+        size_t bytes = entry->memoryUsage();
+        resident = resident - entry->charged + bytes;
+        entry->charged = bytes;
+
+        evict();
+    }
+
+    void recordHit() {
+        std::lock_guard<std::mutex> lock(mutex);
+        hits++;
+    }
+
+    void recordMiss() {
+        std::lock_guard<std::mutex> lock(mutex);
+        misses++;
+    }
+
+    void setBudget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    FileCacheStats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        FileCacheStats stats;
+        stats.hits = hits;
+        stats.misses = misses;
+        stats.evictions = evictions;
+        stats.entries = entries.size();
+        stats.residentBytes = resident;
+        stats.budget = budget;
+        return stats;
+    }
+
+private:
+    struct Slot {
+        std::shared_ptr<FileCache> entry;
+        std::list<std::string>::iterator position;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Slot> entries;
+
+    // Most recently used first
+    std::list<std::string> order;
+
+    size_t budget;
+    size_t resident = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
 
-enum HTMLParserState {
-    TEXT,
-    TAGNAME,
-    ATTRIBUTE,
-    ATTRIBUTE_VALUE,
-    COMMENT,
-    INLINE_VALUE,
-    RAW_ELEMENT,
-    TEMPLATE_PATH
+    void evict() {
+        auto position = order.end();
+        while (resident > budget && position != order.begin()) {
+            --position;
+
+            auto found = entries.find(*position);
+
+            // Pinned, someone else still holds it
+            if (found->second.entry.use_count() > 1) continue;
+
+            resident -= found->second.entry->charged;
+            evictions++;
+
+            entries.erase(found);
+            position = order.erase(position);
+        }
+    }
 };
 
+// Global file cache
+static FileCacheStore fileCache;
 
-void* empty = nullptr;
+// Global cache for entries parsed with recordSlots (their content lacks the slot output)
+static FileCacheStore planCache;
 
-const std::streamsize MAX_FILE_SIZE = 10 * 1024 * 1024;
 
+/*
+    Path locks
 
-class HTMLParserOptions {
+    Lets several contexts fill the same cache at once. A context holds the lock of the file it is parsing, so two
+    pages sharing a template don't parse (or modify) the template entry at the same time.
+    Locks are recursive since fromFile is re-entered for templates. Locks are never freed - an instance shared by
+    everything that uses a cache (like the one of the plan cache) keeps one mutex per page it has seen.
+*/
+class PathLocks {
 public:
-    // Whether to collect and store/reconstruct chunks of the code back into a buffer
-    const bool buffer;
+    std::unique_lock<std::recursive_mutex> lock(const std::string& path) {
+        std::recursive_mutex* pathMutex;
 
-    // Minify the output
-    bool compact = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pathMutex = &locks[path];
+        }
 
-    // Use vanilla HTML parsing (drop custom syntax)
-    bool vanilla = false;
+        return std::unique_lock<std::recursive_mutex>(*pathMutex);
+    }
 
-    std::string header = "";
-    std::function<void(std::string&, std::stack<std::string_view>&, std::string_view, void*)> onText = nullptr;
-    std::function<void(std::string&, std::stack<std::string_view>&, std::string_view, void*)> onOpeningTag = nullptr;
-    std::function<void(std::string&, std::stack<std::string_view>&, std::string_view, void*)> onClosingTag = nullptr;
-    std::function<void(std::string&, std::stack<std::string_view>&, std::string_view, void*)> onInline = nullptr;
-    std::function<void(void*)> onEnd = nullptr;
+    /**
+     * Same as lock, but doesn't wait - the returned lock doesn't own the mutex if another thread holds it.
+     */
+    std::unique_lock<std::recursive_mutex> tryLock(const std::string& path) {
+        std::recursive_mutex* pathMutex;
 
-    HTMLParserOptions(bool buffer) : buffer(buffer) {
-        if(buffer) {
-            onText = _defaultOnText;
-            onOpeningTag = _defaultOnOpeningTag;
-            onClosingTag = _defaultOnClosingTag;
-            onInline = _defaultOnInline;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pathMutex = &locks[path];
         }
-    };
 
-    static void _defaultOnText(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void* userData) {
-        buffer.append(value);
+        return std::unique_lock<std::recursive_mutex>(*pathMutex, std::try_to_lock);
     }
 
-    static void _defaultOnOpeningTag(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
-        buffer.append("<").append(std::string(tag));
-    }
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, std::recursive_mutex> locks;
+};
 
-    static void _defaultOnClosingTag(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
-        buffer.append("</").append(std::string(tag)).append(">");
-    }
 
-    static void _defaultOnInline(std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void* userData) {
-        buffer.append("<span data-reactive=\"").append(std::string(value)).append("\"></span>");
-    }
+/**
+ * A contiguous range of some source string that ends up in the composed document.
+ */
+struct OutputPiece {
+    const std::string* source;
+    size_t begin;
+    size_t end;
+
+    // Entry whose slots may land in this piece (and which of them), if any
+    const FileCache* owner = nullptr;
+    size_t slotFrom = 0;
+    size_t slotTo = SIZE_MAX;
 };
 
 
-struct FileCache {
-    std::filesystem::file_time_type lastModified;
-    size_t templateChunkSplit = 0;
-    std::string path;
-    std::string content;
+/*
+    Handler policies
 
-    // FIXME: Would be safer to use path
-    std::shared_ptr<FileCache> templateCache = nullptr;
-    std::filesystem::file_time_type templateLastModified;
+    The parsing context calls its token handlers through a policy type, so a configuration that is known at compile
+    time gets its handlers inlined into the state machine instead of going through std::function on every token.
 
-    FileCache() = default;
+    RuntimeHandlers calls the callbacks set in HTMLParserOptions. It is the configurable API, used by the N-API
+    binding and anything else that sets its own callbacks. DefaultHandlers is buffer mode with the _defaultOn*
+    handlers, ignoring whatever callbacks the options hold. compact and vanilla stay runtime flags in both, they
+    are checked per tag rather than per byte.
+*/
 
-    FileCache(const std::string& path, std::filesystem::file_time_type lastModified)
-        : path(path), lastModified(lastModified), templateCache(nullptr), templateLastModified(lastModified) {}
+struct RuntimeHandlers {
+    static bool hasText(const HTMLParserOptions& options) { return (bool) options.onText; }
+    static bool hasOpeningTag(const HTMLParserOptions& options) { return (bool) options.onOpeningTag; }
+    static bool hasClosingTag(const HTMLParserOptions& options) { return (bool) options.onClosingTag; }
+    static bool hasInline(const HTMLParserOptions& options) { return (bool) options.onInline; }
+    static bool hasEnd(const HTMLParserOptions& options) { return (bool) options.onEnd; }
+    static bool hasBlock(const HTMLParserOptions& options) { return (bool) options.onBlock; }
+
+    // Only the default handler is known not to need a text node whole (eg. to minify a script)
+    static bool canSplitText(const HTMLParserOptions& options) {
+        auto handler = options.onText.target<decltype(&HTMLParserOptions::_defaultOnText)>();
+        return handler && *handler == &HTMLParserOptions::_defaultOnText;
+    }
 
-    FileCache(const std::string& path, const std::string& content, std::filesystem::file_time_type lastModified)
-        : path(path), content(content), lastModified(lastModified), templateCache(nullptr), templateLastModified(lastModified) {}
+    static void onText(const HTMLParserOptions& options, std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void* userData) {
+        options.onText(buffer, tagStack, value, userData);
+    }
 
-    bool operator==(const FileCache& other) const {
-        return path == other.path;
+    static void onOpeningTag(const HTMLParserOptions& options, std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
+        options.onOpeningTag(buffer, tagStack, tag, userData);
     }
-};
 
+    static void onClosingTag(const HTMLParserOptions& options, std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
+        options.onClosingTag(buffer, tagStack, tag, userData);
+    }
 
-struct HTMLParsingPosition {
-    // std::shared_ptr<std::vector<char>> buffer = nullptr;
-    const char* it;
-    const char* chunk_end;
-    const char* value_start;
-    std::string* output;
-    std::shared_ptr<FileCache> cacheEntry;
+    static void onInline(const HTMLParserOptions& options, std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void* userData) {
+        options.onInline(buffer, tagStack, value, userData);
+    }
 
-    HTMLParsingPosition() 
-        : it(nullptr), chunk_end(nullptr), value_start(nullptr), output(nullptr), cacheEntry(nullptr) {}
+    static void onEnd(const HTMLParserOptions& options, void* userData) {
+        options.onEnd(userData);
+    }
 
-    HTMLParsingPosition(const char* it, const char* chunk_end, const char* value_start, std::string* output = nullptr, std::shared_ptr<FileCache> cacheEntry = nullptr) 
-        : it(it), chunk_end(chunk_end), value_start(value_start), output(output), cacheEntry(std::move(cacheEntry)) {}
+    static void onBlock(const HTMLParserOptions& options, std::string& buffer, std::stack<std::string_view>& tagStack, const AtriumBlock& block, void* userData) {
+        options.onBlock(buffer, tagStack, block, userData);
+    }
 };
 
+struct DefaultHandlers {
+    // Same as HTMLParserOptions, which only sets the defaults when buffering
+    static bool hasText(const HTMLParserOptions& options) { return options.buffer; }
+    static bool hasOpeningTag(const HTMLParserOptions& options) { return options.buffer; }
+    static bool hasClosingTag(const HTMLParserOptions& options) { return options.buffer; }
+    static bool hasInline(const HTMLParserOptions& options) { return options.buffer; }
+    static constexpr bool hasEnd(const HTMLParserOptions&) { return false; }
+    static constexpr bool hasBlock(const HTMLParserOptions&) { return false; }
+    static constexpr bool canSplitText(const HTMLParserOptions&) { return true; }
+
+    static void onText(const HTMLParserOptions&, std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void* userData) {
+        HTMLParserOptions::_defaultOnText(buffer, tagStack, value, userData);
+    }
+
+    static void onOpeningTag(const HTMLParserOptions&, std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
+        HTMLParserOptions::_defaultOnOpeningTag(buffer, tagStack, tag, userData);
+    }
+
+    static void onClosingTag(const HTMLParserOptions&, std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view tag, void* userData) {
+        HTMLParserOptions::_defaultOnClosingTag(buffer, tagStack, tag, userData);
+    }
+
+    static void onInline(const HTMLParserOptions&, std::string& buffer, std::stack<std::string_view>& tagStack, std::string_view value, void* userData) {
+        HTMLParserOptions::_defaultOnInline(buffer, tagStack, value, userData);
+    }
 
-// Global cache map
-static std::unordered_map<std::string, std::shared_ptr<FileCache>> fileCache;
+    static void onEnd(const HTMLParserOptions&, void*) {}
+    static void onBlock(const HTMLParserOptions&, std::string&, std::stack<std::string_view>&, const AtriumBlock&, void*) {}
+};
 
-class HTMLParsingContext {
+template <typename Handlers>
+class BasicHTMLParsingContext {
 public:
-    explicit HTMLParsingContext(std::string_view buf, HTMLParserOptions& options)
+    explicit BasicHTMLParsingContext(std::string_view buf, HTMLParserOptions& options)
         : options(options),
         buffer(buf), it(buf.data()), chunk_end(buf.data() + buf.size()), value_start(buf.data()) {}
 
-    explicit HTMLParsingContext(HTMLParserOptions& options)
+    explicit BasicHTMLParsingContext(HTMLParserOptions& options)
         : options(options) {}
 
     void write(std::string_view buf, std::string* _output = nullptr, void* userData = nullptr, std::string rootPath = "") {
@@ -185,192 +3179,487 @@ public:
         }
 
         cacheEntry = nullptr;
+        partial = false;
         resume();
     }
 
-    bool needsUpdate(std::string filePath) {
-        auto cacheIt = fileCache.find(filePath);
-        if (cacheIt == fileCache.end()) {
-            return true;
+    /**
+     * Feed the next chunk of a document that arrives in pieces (eg. from a fs/HTTP stream).
+     * Chunks can be split at any byte - whatever belongs to an unfinished token is kept in an owned buffer (carry)
+     * and continued with the next chunk. Text and raw element bodies (script, style) are written out as far as they are known
+     * with each chunk when onText is the default handler, otherwise (and for compact styles) the carry holds a body until it ends.
+     * Since the output can't be gone back to, <ls::template> scripts are emitted in place instead of at the end of the body.
+     * Output is emitted as soon as it is known, call end() after the last chunk.
+     */
+    void stream(std::string_view chunk, std::string* _output = nullptr, void* userData = nullptr) {
+        if (options.buffer && _output == nullptr && output == nullptr) {
+            throw std::invalid_argument("Output string cannot be undefined when buffer option is enabled.");
         }
 
-        if (!std::filesystem::exists(filePath)) return true;
-        auto fileModTime = std::filesystem::last_write_time(filePath);
-        if (cacheIt->second->lastModified != fileModTime) {
+        if (_output) {
+            output = _output;
+        }
+
+        if(userData) {
+            this->userData = userData;
+        }
+
+        if (!streaming) {
+            streaming = true;
+            cacheEntry = nullptr;
+            carry.clear();
+            carry_it = carry_value = 0;
+        }
+
+        if (carry.empty()) {
+            // Nothing left over, parse the chunk in place
+            buffer = chunk;
+        } else {
+            carry.append(chunk);
+            buffer = carry;
+        }
+
+        it = buffer.data() + carry_it;
+        value_start = buffer.data() + carry_value;
+        chunk_end = buffer.data() + buffer.size();
+
+        partial = true;
+        resume();
+    }
+
+    bool needsUpdate(std::string filePath) {
+        std::shared_ptr<FileCache> entry = cache->find(filePath);
+        if (!entry) {
             return true;
         }
 
-        // Check template file modification time if it exists
-        // NOTE: Make sure it gets handled if the template gets deleted
-        if (cacheIt->second->templateCache != nullptr) {
-            const auto& tmpl = cacheIt->second->templateCache;
-            if (!std::filesystem::exists(tmpl->path)) return true;
-            auto templateModTime = std::filesystem::last_write_time(tmpl->path);
-            if (cacheIt->second->templateLastModified != templateModTime) {
-                return true;
+        // Being parsed by another context right now, can't be up to date
+        std::unique_lock<std::recursive_mutex> pathLock, templateLock;
+        if (locks) {
+            pathLock = locks->tryLock(entry->path);
+            if (!pathLock.owns_lock()) return true;
+
+            if (entry->templateCache) {
+                templateLock = locks->tryLock(entry->templateCache->path);
+                if (!templateLock.owns_lock()) return true;
             }
         }
-        return false;
+
+        // Deleted files count as changed too
+        return entry->outdated();
     }
 
-    // TODO: This *needs* a better implementation
-    std::string exportCopy(const std::shared_ptr<FileCache>& cacheEntry) {
-        if (!cacheEntry) return "";
+    /**
+     * Offsets of <head> and </head> in a cached file, as recorded while parsing.
+     * Falls back to searching the content if they weren't recorded or don't match (eg. <head> with attributes or custom tag callbacks).
+     */
+    static std::pair<size_t, size_t> headRange(const FileCache& entry) {
+        const std::string& content = entry.content;
+
+        size_t open = entry.headOpen;
+        if (open == std::string::npos || content.compare(open, 6, "<head>") != 0) {
+            open = content.find("<head>");
+        }
+
+        size_t close = entry.headClose;
+        if (close == std::string::npos || content.compare(close, 7, "</head>") != 0) {
+            close = content.find("</head>");
+        }
+
+        return { open, close };
+    }
+
+    std::string documentPrefix() {
+        return "<!DOCTYPE html>\n" + options.header + "\n<html lang=\"en\">";
+    }
+
+    /**
+     * Lays out the composed document (header, template and the file itself) as pieces of the cached contents,
+     * so it can be copied out or turned into a render plan without building intermediate strings.
+     * The prefix must outlive the returned pieces.
+     */
+    std::vector<OutputPiece> composePieces(const std::shared_ptr<FileCache>& cacheEntry, const std::string& prefix) {
+        static const std::string suffix = "</html>";
+
+        const FileCache* page = cacheEntry.get();
+        const std::string& fileContent = page->content;
+
+        std::vector<OutputPiece> pieces;
+        pieces.push_back({ &prefix, 0, prefix.size() });
+
+        // Compiled <ls::template> functions go in front of the content they were found in
+        auto scriptPiece = [&](const FileCache* entry) {
+            if (!entry->script.empty()) pieces.push_back({ &entry->script, 0, entry->script.size() });
+        };
 
         // If no template, just wrap the (possibly trimmed) file content
-        if (!cacheEntry->templateCache) return "<!DOCTYPE html>\n" + options.header + "\n<html lang=\"en\">" + cacheEntry->content + "</html>";
+        if (!page->templateCache) {
+            scriptPiece(page);
+            pieces.push_back({ &fileContent, 0, fileContent.size(), page });
+            pieces.push_back({ &suffix, 0, suffix.size() });
+            return pieces;
+        }
+
+        // 1. Extract the file's <head>…</head> content
+        std::vector<OutputPiece> filePieces;
+        OutputPiece fileHeadInner { nullptr, 0, 0 };
 
-        // 1. Extract and remove the file's <head>…</head> content
-        std::string fileContent = cacheEntry->content;
-        std::string fileHeadInner;
-        size_t fileHeadOpen = fileContent.find("<head>");
-        size_t fileHeadClose = fileContent.find("</head>");
+        auto [fileHeadOpen, fileHeadClose] = headRange(*page);
         if (fileHeadOpen != std::string::npos && fileHeadClose != std::string::npos && fileHeadClose > fileHeadOpen) {
-            size_t innerStart = fileHeadOpen + 6; // after "<head>"
-            fileHeadInner = fileContent.substr(innerStart, fileHeadClose - innerStart);
-            fileContent.erase(fileHeadOpen, fileHeadClose + 7 - fileHeadOpen); // remove "<head>…</head>"
+            fileHeadInner = { &fileContent, fileHeadOpen + 6, fileHeadClose, page };
+            filePieces.push_back({ &fileContent, 0, fileHeadOpen, page });
+            filePieces.push_back({ &fileContent, fileHeadClose + 7, fileContent.size(), page });
+        } else {
+            filePieces.push_back({ &fileContent, 0, fileContent.size(), page });
         }
 
-        // 2. Merge extracted head into the template's <head>
-        const auto *tmpl = cacheEntry->templateCache.get();
-        std::string combinedTemplateContent = tmpl->content;
+        // 2. Find where it merges into the template's <head>
+        const FileCache* tmpl = page->templateCache.get();
+        const std::string& tmplContent = tmpl->content;
 
-        size_t tmplHeadOpen2 = std::string::npos;
-        size_t tmplHeadClose2 = std::string::npos;
-        if (!fileHeadInner.empty()) {
-            tmplHeadOpen2 = combinedTemplateContent.find("<head>");
-            tmplHeadClose2 = combinedTemplateContent.find("</head>");
-            if (tmplHeadOpen2 != std::string::npos && tmplHeadClose2 != std::string::npos && tmplHeadClose2 > tmplHeadOpen2) {
-                combinedTemplateContent.insert(tmplHeadClose2, fileHeadInner);
+        size_t tmplHeadClose = std::string::npos;
+        if (fileHeadInner.end > fileHeadInner.begin) {
+            auto [tmplHeadOpen, tmplHeadEnd] = headRange(*tmpl);
+            tmplHeadClose = tmplHeadEnd;
+            if (tmplHeadOpen == std::string::npos || tmplHeadClose == std::string::npos || tmplHeadClose <= tmplHeadOpen) {
+                tmplHeadClose = std::string::npos;
             }
         }
 
-        // 3. Build result, adjusting split if head insert was before it
+        // 3. Lay out the template around the file content
         const bool hasSplit = tmpl->templateChunkSplit > 0;
-        const size_t origSplit = tmpl->templateChunkSplit;
-        size_t splitPoint = origSplit;
-        if (tmplHeadClose2 != std::string::npos && tmplHeadClose2 < origSplit) {
-            splitPoint += fileHeadInner.size();
-        }
+        const size_t split = hasSplit? tmpl->templateChunkSplit: tmplContent.size();
 
-        const size_t tmplLen = combinedTemplateContent.size();
-        size_t resultSize = fileContent.size() + options.header.size() + 15;
-        if (hasSplit) {
-            resultSize += splitPoint;
-            resultSize += tmplLen - splitPoint;
+        auto templatePiece = [&](size_t begin, size_t end) {
+            OutputPiece piece { &tmplContent, begin, end, tmpl };
+            if (hasSplit) {
+                if (end <= split) piece.slotTo = tmpl->templateChunkSplitSlot;
+                else piece.slotFrom = tmpl->templateChunkSplitSlot;
+            }
+            return piece;
+        };
+
+        scriptPiece(tmpl);
+
+        if (tmplHeadClose != std::string::npos && tmplHeadClose < split) {
+            pieces.push_back(templatePiece(0, tmplHeadClose));
+            pieces.push_back(fileHeadInner);
+            pieces.push_back(templatePiece(tmplHeadClose, split));
         } else {
-            resultSize += tmplLen;
+            pieces.push_back(templatePiece(0, split));
         }
 
-        std::string result = "<!DOCTYPE html>\n" + options.header + "\n<html lang=\"en\">";
-        result.reserve(resultSize);
+        scriptPiece(page);
+        pieces.insert(pieces.end(), filePieces.begin(), filePieces.end());
 
-        if (hasSplit) {
-            result.append(combinedTemplateContent, 0, splitPoint);
+        if (tmplHeadClose != std::string::npos && tmplHeadClose >= split) {
+            pieces.push_back(templatePiece(split, tmplHeadClose));
+            pieces.push_back(fileHeadInner);
+            pieces.push_back(templatePiece(tmplHeadClose, tmplContent.size()));
         } else {
-            result.append(combinedTemplateContent);
+            pieces.push_back(templatePiece(split, tmplContent.size()));
         }
 
-        result.append(fileContent);
+        pieces.push_back({ &suffix, 0, suffix.size() });
+        return pieces;
+    }
 
-        if (hasSplit) {
-            result.append(combinedTemplateContent, splitPoint, tmplLen - splitPoint);
+    /**
+     * Same as exportCopy, but the result is kept on the cache entry and shared until the file, its template or the header changes.
+     */
+    std::shared_ptr<const std::string> exportShared(const std::shared_ptr<FileCache>& cacheEntry) {
+        if (!cacheEntry) return std::make_shared<const std::string>();
+
+        uint64_t templateRevision = cacheEntry->templateCache? cacheEntry->templateCache->revision: 0;
+        if (!cacheEntry->composed || cacheEntry->composedHeader != options.header || cacheEntry->composedTemplateRevision != templateRevision) {
+            cacheEntry->composed = std::make_shared<const std::string>(exportCopy(cacheEntry));
+            cacheEntry->composedDigest = ContentDigest::of(*cacheEntry->composed);
+            cacheEntry->composedHeader = options.header;
+            cacheEntry->composedTemplateRevision = templateRevision;
+            cache->charge(cacheEntry);
         }
 
-        return result + "</html>";
+        return cacheEntry->composed;
     }
 
-    FileCache& fromFile(std::string filePath, void* userData = nullptr, std::string rootPath = "", bool checkCache = true) {
+    /**
+     * Compression dictionary for pages that use the given entry as their template - its script and content, which every
+     * such page repeats. Kept until the template is parsed again, so its digest is stable between versions.
+     */
+    std::shared_ptr<const std::string> dictionaryOf(const std::shared_ptr<FileCache>& templateEntry) {
+        if (!templateEntry) return nullptr;
+
+        if (!templateEntry->dictionary) {
+            templateEntry->dictionary = std::make_shared<const std::string>(templateEntry->script + templateEntry->content);
+            templateEntry->dictionaryDigest = ContentDigest::of(*templateEntry->dictionary);
+            cache->charge(templateEntry);
+        }
+
+        return templateEntry->dictionary;
+    }
+
+    std::string exportCopy(const std::shared_ptr<FileCache>& cacheEntry) {
+        if (!cacheEntry) return "";
+
+        std::string prefix = documentPrefix();
+        std::vector<OutputPiece> pieces = composePieces(cacheEntry, prefix);
+
+        size_t size = 0;
+        for (const auto& piece : pieces) size += piece.end - piece.begin;
+
+        std::string result;
+        result.reserve(size);
+        for (const auto& piece : pieces) {
+            result.append(*piece.source, piece.begin, piece.end - piece.begin);
+        }
+
+        return result;
+    }
+
+    /**
+     * Turns a cache entry (parsed with recordSlots) and its template into a render plan.
+     */
+    std::shared_ptr<const RenderPlan> buildPlan(const std::shared_ptr<FileCache>& cacheEntry) {
+        auto plan = std::make_shared<RenderPlan>();
+        plan->header = options.header;
+        plan->templateRevision = cacheEntry->templateCache? cacheEntry->templateCache->revision: 0;
+
+        std::string prefix = documentPrefix();
+        std::vector<OutputPiece> pieces = composePieces(cacheEntry, prefix);
+
+        // Every slot goes to the first piece of its entry that contains its offset
+        std::vector<std::vector<const RenderSlot*>> assigned(pieces.size());
+        for (const FileCache* owner : { cacheEntry.get(), cacheEntry->templateCache.get() }) {
+            if (!owner) continue;
+
+            for (size_t i = 0; i < owner->slots.size(); ++i) {
+                const RenderSlot& slot = owner->slots[i];
+
+                for (size_t p = 0; p < pieces.size(); ++p) {
+                    const OutputPiece& piece = pieces[p];
+                    if (piece.owner == owner && i >= piece.slotFrom && i < piece.slotTo && slot.offset >= piece.begin && slot.offset <= piece.end) {
+                        assigned[p].push_back(&slot);
+                        break;
+                    }
+                }
+            }
+        }
+
+        size_t size = 0;
+        for (const auto& piece : pieces) size += piece.end - piece.begin;
+        plan->statics.reserve(size);
+
+        for (size_t p = 0; p < pieces.size(); ++p) {
+            const OutputPiece& piece = pieces[p];
+
+            for (const RenderSlot* slot : assigned[p]) {
+                plan->slots.push_back(*slot);
+                plan->slots.back().offset = plan->statics.size() + (slot->offset - piece.begin);
+            }
+
+            plan->statics.append(*piece.source, piece.begin, piece.end - piece.begin);
+        }
+
+        plan->digest = ContentDigest::of(plan->statics);
+
+        size_t batchLength = 0;
+        plan->batchEvents.reserve(plan->slots.size() * 5);
+        for (const RenderSlot& slot : plan->slots) {
+            if (slot.type != SLOT_BODY_ATTRIBUTES && slot.type != SLOT_DATA && slot.type != SLOT_BLOCK) plan->scriptSlots++;
+            if (slot.type == SLOT_DATA) plan->dataSlots++;
+
+            plan->batchEvents.push_back(slot.type);
+
+            for (const std::string* text : { &slot.value, &slot.parent }) {
+                size_t length = utf16Length(*text);
+                plan->batchEvents.push_back((uint32_t) batchLength);
+                plan->batchEvents.push_back((uint32_t) length);
+                plan->batchSource.append(*text);
+                batchLength += length;
+            }
+        }
+
+        return plan;
+    }
+
+    /**
+     * Parse a file (if it changed) and return its render plan. Should be used with recordSlots enabled.
+     */
+    std::shared_ptr<const RenderPlan> compile(std::string filePath, void* userData = nullptr, std::string rootPath = "") {
         filePath = std::filesystem::path(filePath).lexically_normal().string();
-        if (!std::filesystem::exists(filePath)) {
-            throw std::runtime_error("Unable to open file: " + filePath);
+        auto pathLock = lockPath(filePath);
+
+        FileCache& result = fromFile(filePath, userData, rootPath);
+        std::shared_ptr<FileCache> entry = cache->find(result.path);
+
+        uint64_t templateRevision = entry->templateCache? entry->templateCache->revision: 0;
+        if (!entry->plan || entry->plan->header != options.header || entry->plan->templateRevision != templateRevision) {
+            entry->plan = buildPlan(entry);
+            cache->charge(entry);
         }
-        auto fileModTime = std::filesystem::last_write_time(filePath);
-        bool contentCached = true;
-        bool templateCached = true;
+
+        return entry->plan;
+    }
+
+    /**
+     * Record a render slot at the current output position.
+     */
+    void recordSlot(RenderSlotType type, std::string_view value) {
+        RenderSlot slot { type, output->size(), std::string(value), tagStack.empty()? std::string(): std::string(tagStack.top()) };
+
+        if (cacheEntry) {
+            cacheEntry->slots.push_back(std::move(slot));
+        } else {
+            slots.push_back(std::move(slot));
+        }
+    }
+
+    /**
+     * Drop all parsing state, eg. after the context was only used as a write target.
+     */
+    void discard() {
+        resetState();
+    }
+
+    FileCache& fromFile(std::string filePath, void* userData = nullptr, std::string rootPath = "", bool checkCache = true) {
+        filePath = std::filesystem::path(filePath).lexically_normal().string();
+        auto pathLock = lockPath(filePath);
 
         if (checkCache) {
-            auto cacheIt = fileCache.find(filePath);
-            contentCached = cacheIt != fileCache.end() && cacheIt->second->lastModified == fileModTime;
-
-            if (contentCached && cacheIt->second->templateCache != nullptr) {
-                auto templateModTime = std::filesystem::last_write_time(cacheIt->second->templateCache->path);
-                if (cacheIt->second->templateLastModified != templateModTime) {
-                    cacheIt->second->templateLastModified = templateModTime;
-                    templateCached = false;
-
-                    if (contentCached) {
-                        fromFile(cacheIt->second->templateCache->path, userData, rootPath);
-                        return *cacheIt->second;
+            std::shared_ptr<FileCache> entry = cache->find(filePath);
+
+            if (entry && !entry->changed()) {
+                // Only the template changed, the content itself can stay
+                if (entry->templateCache != nullptr) {
+                    if (entry->templateCache->changed()) {
+                        fromFile(entry->templateCache->path, userData, rootPath);
                     }
+
+                    entry->templateRevision = entry->templateCache->revision;
                 }
-            }
 
-            if (contentCached && templateCached) {
-                cacheEntry = cacheIt->second;
-                return *cacheIt->second;
+                cache->recordHit();
+                cacheEntry = entry;
+                return *entry;
             }
         }
 
-        auto newEntry = std::make_shared<FileCache>(filePath, fileModTime);
-        auto [insertIt, inserted] = fileCache.emplace(filePath, newEntry);
-        cacheEntry = insertIt->second;
+        cache->recordMiss();
+
+        std::shared_ptr<const SourceFile> source = SourceFile::load(filePath, options.maxFileSize);
+        auto fileModTime = std::filesystem::last_write_time(filePath);
+
+        auto [entry, inserted] = cache->emplace(filePath, std::make_shared<FileCache>(filePath, fileModTime));
+        cacheEntry = entry;
+
+        // The last output is the best guess for the next one, the source size for a new entry
+        size_t expectedSize = cacheEntry->content.size();
 
         if (!inserted) {
             cacheEntry->content.clear();
+            cacheEntry->script.clear();
+            cacheEntry->slots.clear();
+            cacheEntry->plan = nullptr;
+            cacheEntry->composed = nullptr;
+            cacheEntry->dictionary = nullptr;
+            cacheEntry->headOpen = cacheEntry->headClose = std::string::npos;
             cacheEntry->lastModified = fileModTime;
         }
 
-        std::ifstream file(filePath, std::ios::in | std::ios::binary | std::ios::ate);
-        if (!file.is_open()) {
-            throw std::runtime_error("Unable to open file: " + filePath);
-        }
-
-        std::streamsize size = file.tellg();
-        if (size > MAX_FILE_SIZE) {
-            throw std::runtime_error("File size exceeds the maximum limit of " + std::to_string(MAX_FILE_SIZE) + " bytes.");
-        }
+        cacheEntry->revision = nextRevision.fetch_add(1, std::memory_order_relaxed);
+        cacheEntry->dependencies.clear();
+        cacheEntry->dependencies.push_back(source->dependency);
+        cacheEntry->sources.clear();
+        cacheEntry->sources.push_back(source);
 
-        if(size == 0) {
+        std::string_view fileContent = source->view();
+        if(fileContent.empty()) {
             cacheEntry->content.clear();
+            cache->charge(entry);
             return *cacheEntry;
         }
 
-        file.seekg(0, std::ios::beg);
-        std::vector<char> fileBuffer(size);
-        if (!file.read(fileBuffer.data(), size)) {
-            throw std::runtime_error("Error reading file: " + filePath);
+        this->rootPath = rootPath;
+        if (userData) this->userData = userData;
+
+        // Entries without JS output can be reused from an earlier run
+        DiskCache* disk = options.recordSlots? cache->disk.load(std::memory_order_acquire): nullptr;
+        if (disk && !disk->enabled()) disk = nullptr;
+        uint64_t diskKey = 0, sourceHash = 0;
+
+        if (disk) {
+            diskKey = DiskCache::key(filePath, rootPath, options.cacheKey() + (templateEnabled? 'T': '-'));
+            sourceHash = DiskCache::hash(fileContent);
+
+            std::string templatePath;
+            if (disk->load(diskKey, sourceHash, *entry, templatePath)) {
+                if (!templatePath.empty() && templateEnabled) {
+                    loadTemplate(templatePath, userData, rootPath);
+                }
+
+                cache->charge(entry);
+                return *entry;
+            }
         }
 
-        std::string_view fileContent(fileBuffer.data(), fileBuffer.size());
+        // Output only grows by the slack, instead of doubling on every edit that crosses the capacity
+        if (expectedSize == 0) expectedSize = fileContent.size();
+        cacheEntry->content.reserve(expectedSize + expectedSize / 8 + 64);
 
         output = &cacheEntry->content;
         it = fileContent.data();
         chunk_end = fileContent.data() + fileContent.size();
         value_start = it;
 
-        this->rootPath = rootPath;
-        if (userData) this->userData = userData;
-
+        partial = false;
         resume();
         end();
-        return *cacheEntry;
+
+        if (disk) {
+            disk->store(diskKey, sourceHash, *entry, entry->templateCache? entry->templateCache->path: "");
+        }
+
+        cache->charge(entry);
+        return *entry;
     }
 
     void end() {
-        if(options.onClosingTag) {
+        if (streaming && !carry.empty()) {
+            // Flush whatever was left over from the last chunk
+            buffer = carry;
+            it = carry.data() + carry_it;
+            value_start = carry.data() + carry_value;
+            chunk_end = carry.data() + carry.size();
+
+            partial = false;
+            resume();
+        }
+
+        if(Handlers::hasClosingTag(options)) {
             while (!tagStack.empty()) {
-                options.onClosingTag(*output, tagStack, tagStack.top(), userData);
+                Handlers::onClosingTag(options, *output, tagStack, tagStack.top(), userData);
                 tagStack.pop();
             }
         }
 
-        if (options.onEnd) {
-            options.onEnd(userData);
+        if (Handlers::hasEnd(options)) {
+            Handlers::onEnd(options, userData);
         }
 
         if (options.buffer && output && !ls_inline_script.empty()) {
-            output->insert(0, "<script>\n" + ls_inline_script + "</script>\n");
+            if (cacheEntry) {
+                // Kept next to the content, composition puts it in front without moving the content
+                cacheEntry->script.reserve(ls_inline_script.size() + 19);
+                cacheEntry->script.append("<script>\n").append(ls_inline_script).append("</script>\n");
+            } else {
+                std::string script = "<script>\n" + ls_inline_script + "</script>\n";
+                output->insert(0, script);
+
+                for (auto& slot : slots) {
+                    slot.offset += script.size();
+                }
+            }
+
             ls_inline_script.clear();
         }
 
@@ -385,8 +3674,23 @@ public:
     }
 
     void resume() {
-        if(reset) {
-            if (*it == '#' && (it + 9) < chunk_end && std::string_view(it, 10) == "#template ") {
+        if (options.vanilla) tokenize<true>();
+        else tokenize<false>();
+    }
+
+    /**
+     * The state machine, run until the end of the current chunk.
+     * The vanilla build leaves out every branch for custom syntax ({{ }}, scopes, .class/#id shorthands, #template, <ls::template>),
+     * so plain HTML is not checked for any of it, while the output for plain HTML stays the same.
+     */
+    template <bool Vanilla>
+    void tokenize() {
+        // While streaming, we must not act on a token that might continue in the next chunk.
+        // Stopping a fixed distance before the end covers all lookaheads done by the state machine.
+        const char* parse_end = (partial && chunk_end - it > STREAM_LOOKAHEAD)? chunk_end - STREAM_LOOKAHEAD: partial? it: chunk_end;
+
+        if(reset && parse_end > it) {
+            if (!Vanilla && it < chunk_end && *it == '#' && (it + 9) < chunk_end && std::string_view(it, 10) == "#template ") {
                 state = TEMPLATE_PATH;
                 it += 9;
                 value_start = it + 1;
@@ -394,19 +3698,29 @@ public:
 
             if(options.buffer && output->size() == 0) {
                 // *output = "<!DOCTYPE html>\n" + options.header + "\n<html>";
-                output->reserve(this->buffer.size() + 64);
+                output->reserve((chunk_end - it) + 64);
             }
 
             reset = false;
         }
 
-        for (; it < chunk_end; ++it) {
+        for (; it < parse_end; ++it) {
 
-            if (ls_template_capture) {
+            if (!Vanilla && ls_template_capture) {
                 constexpr std::string_view closing = "</ls::template>";
                 std::string_view remaining(it, chunk_end - it);
                 auto pos = remaining.find(closing);
                 if (pos == std::string_view::npos) {
+                    if (partial) {
+                        // The closing tag may be split between chunks, keep its possible beginning
+                        size_t safe = remaining.size() > closing.size()? remaining.size() - closing.size(): 0;
+                        ls_template_buffer.append(remaining.substr(0, safe));
+                        it += safe;
+                        value_start = it;
+                        suspended_at = it;
+                        break;
+                    }
+
                     ls_template_buffer.append(remaining);
                     it = chunk_end;
                     break;
@@ -416,7 +3730,14 @@ public:
 
                 ls_template_capture = false;
                 if (!ls_template_id.empty()) {
-                    ls_inline_script.append(buildLsTemplateFunction(ls_template_id, ls_template_buffer));
+                    auto code = LsTemplateCompiler::compile(ls_template_id, ls_template_buffer, options.cloneTemplates? LS_TEMPLATE_CLONE: LS_TEMPLATE_DOM);
+
+                    if (streaming && options.buffer) {
+                        // We can not go back to the beginning of the output when streaming, so emit it in place
+                        output->append("<script>\n").append(*code).append("</script>\n");
+                    } else {
+                        ls_inline_script.append(*code);
+                    }
                 }
                 ls_template_buffer.clear();
                 ls_template_id.clear();
@@ -431,8 +3752,17 @@ public:
                 continue;
             }
 
+            // Skip over runs of bytes that can not change the state
+            if (scanBytes) {
+                if (state == TEXT) it = scanBytes(it, parse_end, '<', Vanilla? '<': '{');
+                else if (state == RAW_ELEMENT) it = scanBytes(it, parse_end, '<', '<');
+                else if (state == COMMENT) it = scanBytes(it, parse_end, '-', '-');
+
+                if (it == parse_end) break;
+            }
+
             if(state == ATTRIBUTE || state == ATTRIBUTE_VALUE || (state == INLINE_VALUE && !space_broken)) {
-                bool isWhitespace = std::isspace(static_cast<unsigned char>(*it));
+                bool isWhitespace = isSpace(*it);
 
                 if(isWhitespace){
                     if(!space_broken) {
@@ -482,7 +3812,7 @@ public:
                         continue;
                     }
 
-                    if (*it == '{' && (it + 1) < chunk_end && it[1] == '{' && (it == buffer.data() || it[-1] != '\\')) {
+                    if (!Vanilla && *it == '{' && (it + 1) < chunk_end && it[1] == '{' && (it == buffer.data() || it[-1] != '\\')) {
                         pushText(*output);
 
                         state = INLINE_VALUE;
@@ -501,16 +3831,22 @@ public:
                             std::string_view topTag = tagStack.top();
                             size_t tagEnd = 2 + topTag.size();
 
+                            if (partial && (it + tagEnd) >= chunk_end) {
+                                suspended_at = it;
+                                break;
+                            }
+
                             if ((it + tagEnd) < chunk_end && it[tagEnd] == '>' && 
                                 std::string_view(it + 2, topTag.size()) == topTag) {
                                 pushText(*output);
 
                                 tagStack.pop();
 
-                                if (options.onClosingTag) {
-                                    options.onClosingTag(*output, tagStack, topTag, userData);
+                                if (Handlers::hasClosingTag(options)) {
+                                    Handlers::onClosingTag(options, *output, tagStack, topTag, userData);
                                 }
 
+                                after_block = tagFlags(topTag) & TAG_BLOCK;
                                 state = TEXT;
 
                                 it += tagEnd;
@@ -522,8 +3858,8 @@ public:
 
                 case TAGNAME:
                     // Templates
-                    if(!is_template && *it == ':' && (it + 1) < chunk_end && it[1] == ':') {
-                        template_scope = std::string_view(value_start, it - value_start);
+                    if(!Vanilla && !is_template && *it == ':' && (it + 1) < chunk_end && it[1] == ':') {
+                        template_scope = intern(std::string_view(value_start, it - value_start));
                         is_template = true;
 
                         value_start = it + 2;
@@ -531,27 +3867,42 @@ public:
                         continue;
                     }
 
-                    if (*it == '>' || *it == '/' || std::isspace(static_cast<unsigned char>(*it))) {
+                    if (hasCharClass(*it, CHAR_TAG_END)) {
 
                         if(!end_tag) {
                             // Handle opening tags
                             std::string_view tag(value_start, it - value_start);
+                            const TagInfo* info = lookupTag(tag);
+                            const uint8_t flags = info? info->flags: 0;
 
-                            ls_template_tag = is_template && template_scope == "ls" && tag == "template";
-                            render_element = !is_template && tag != "html" && tag != "!DOCTYPE";
+                            ls_template_tag = !Vanilla && is_template && template_scope == "ls" && tag == "template";
+                            render_element = !is_template && !(flags & TAG_NO_RENDER);
                             if (ls_template_tag) {
                                 render_element = false;
                             }
 
-                            if (options.onOpeningTag && render_element) {
-                                options.onOpeningTag(*output, tagStack, tag, userData);
+                            if (cacheEntry && (flags & TAG_HEAD) && render_element && cacheEntry->headOpen == std::string::npos) {
+                                cacheEntry->headOpen = output->size();
+                            }
+
+                            if (options.compact && !is_template) {
+                                minifyOpeningTag(info);
+                            }
+
+                            if (Handlers::hasOpeningTag(options) && render_element) {
+                                Handlers::onOpeningTag(options, *output, tagStack, tag, userData);
                             }
 
                             value_start = it + 1;
                             space_broken = false;
 
-                            if (tag == "body" && !body_attributes.empty()) {
-                                output->append(" ").append(body_attributes);
+                            if (flags & TAG_BODY) {
+                                if (options.recordSlots) {
+                                    // Body attributes may be set by slots rendered before this one
+                                    recordSlot(SLOT_BODY_ATTRIBUTES, std::string_view());
+                                } else if (!body_attributes.empty()) {
+                                    output->append(" ").append(body_attributes);
+                                }
                             }
 
                             if(*it == '>' || *it == '/'){
@@ -563,8 +3914,8 @@ public:
                                 }
 
                                 if(*it == '/' && (it + 1) < chunk_end) {
-                                    if (options.onClosingTag) {
-                                        options.onClosingTag(*output, tagStack, tag, userData);
+                                    if (Handlers::hasClosingTag(options)) {
+                                        Handlers::onClosingTag(options, *output, tagStack, tag, userData);
                                     }
                                     value_start = it + 2;
                                     ++it;
@@ -575,12 +3926,12 @@ public:
                                 state = ATTRIBUTE;
                             }
 
-                            if(render_element && voidElements.find(std::string(tag)) == voidElements.end()) {
-                                tagStack.push(tag);
+                            if(render_element && !(flags & TAG_VOID)) {
+                                tagStack.push(info? info->name: intern(tag));
 
-                                if(tag == "head") {
+                                if(flags & TAG_HEAD) {
                                     inside_head = true;
-                                } else if(rawElements.find(std::string(tag)) != rawElements.end()) {
+                                } else if(flags & TAG_RAW) {
                                     if(*it == '>') {
                                         state = RAW_ELEMENT;
                                     } else {
@@ -599,7 +3950,15 @@ public:
 
                         // We can simply ignore anything that is in the closing tag after the tag name.
                         // It should not happen, but well..
-                        if (*it != '>') while(it < chunk_end && *it != '>') ++it;
+                        if (*it != '>') {
+                            const char* name_end = it;
+                            while(it < chunk_end && *it != '>') ++it;
+
+                            if (partial && it == chunk_end) {
+                                suspended_at = name_end;
+                                break;
+                            }
+                        }
 
                         if (it < chunk_end) {
                             value_start = it + 1;
@@ -613,9 +3972,20 @@ public:
                         }
 
                         tagStack.pop();
+
+                        const TagInfo* closingInfo = options.compact? minifyEndTag(closingTag): nullptr;
+
+                        if (cacheEntry && closingTag == "head" && cacheEntry->headClose == std::string::npos) {
+                            cacheEntry->headClose = output->size();
+                        }
                         
-                        if (options.onClosingTag) {
-                            options.onClosingTag(*output, tagStack, closingTag, userData);
+                        size_t end_tag_at = output->size();
+                        if (Handlers::hasClosingTag(options)) {
+                            Handlers::onClosingTag(options, *output, tagStack, closingTag, userData);
+                        }
+
+                        if (closingInfo && (closingInfo->flags & TAG_OPTIONAL_END)) {
+                            deferEndTag(closingInfo, end_tag_at);
                         }
 
                         if(closingTag == "head") {
@@ -639,9 +4009,9 @@ public:
                         continue;
                     }
 
-                    bool isInline = *it == '{' && (it + 1) < chunk_end && it[1] == '{';
+                    bool isInline = !Vanilla && *it == '{' && (it + 1) < chunk_end && it[1] == '{';
 
-                    if(*it == '=' || *it == '>' || *it == '/' || std::isspace(static_cast<unsigned char>(*it)) || isInline) {
+                    if(hasCharClass(*it, CHAR_ATTR_END) || isInline) {
                         if(it > value_start){
                             std::string_view attribute_view(value_start, it - value_start);
                             if(attribute_view.empty()) {
@@ -650,7 +4020,7 @@ public:
                                 break;
                             }
 
-                            if (ls_template_tag) {
+                            if (!Vanilla && ls_template_tag) {
                                 if (attribute_view[0] == '#') {
                                     ls_template_id = std::string(attribute_view.substr(1));
                                 } else {
@@ -658,23 +4028,24 @@ public:
                                 }
                             } else if(options.buffer){
                                 // Handle attributes
-                                if (attribute_view[0] == '#') {
-                                    output->append(" id=\"");
-                                    output->append(attribute_view.substr(1));
-                                    output->append("\"");
-                                } else if (attribute_view[0] == '.') {
+                                if (!Vanilla && attribute_view[0] == '#') {
+                                    output->append(" id=");
+                                    pushQuoted(attribute_view.substr(1), '"');
+                                } else if (!Vanilla && attribute_view[0] == '.') {
                                     if(!class_buffer.empty()) {
                                         class_buffer.append(" ");
                                     }
 
-                                    std::string attribute_str(attribute_view.substr(1));
-                                    std::replace(attribute_str.begin(), attribute_str.end(), '.', ' ');
-                                    class_buffer.append(attribute_str);
+                                    size_t class_start = class_buffer.size();
+                                    class_buffer.append(attribute_view.substr(1));
+                                    std::replace(class_buffer.begin() + class_start, class_buffer.end(), '.', ' ');
                                 } else if (attribute_view == "class") {
                                     flag_appendToClass = true;
                                 } else {
                                     output->append(" ");
+                                    attribute_name_at = output->size();
                                     output->append(attribute_view);
+                                    attribute_name_end = output->size();
                                 }
                             }
                         }
@@ -687,11 +4058,19 @@ public:
                         }
                         
                         if(isInline) {
+                            const char* inline_start = it;
 							it++;
 							value_start = it + 1;
 
                             while(it < chunk_end && !(*it == '}' && (it + 1) < chunk_end && it[1] == '}')) ++it;
 
+                            if (partial && (it + 2) >= chunk_end) {
+                                // Unfinished value, read it again once we have the rest
+                                it = value_start = inline_start;
+                                suspended_at = it;
+                                break;
+                            }
+
                             if(options.buffer && (it > value_start)){
                                 output->append(" data-reactive=\"");
                                 output->append(trim(std::string_view(value_start, it - value_start)));
@@ -720,8 +4099,8 @@ public:
                             }
 
                             _endTag();
-                            if (options.onClosingTag && !tagStack.empty()) {
-                                options.onClosingTag(*output, tagStack, tagStack.top(), userData);
+                            if (Handlers::hasClosingTag(options) && !tagStack.empty()) {
+                                Handlers::onClosingTag(options, *output, tagStack, tagStack.top(), userData);
                                 tagStack.pop();
                             }
                             continue;
@@ -732,7 +4111,7 @@ public:
                 }
 
                 case ATTRIBUTE_VALUE: {
-                    bool end = *it == '>' || std::isspace(static_cast<unsigned char>(*it));
+                    bool end = hasCharClass(*it, CHAR_VALUE_END);
 
                     if(*it == '"' || *it == '\''){
                         if(string_char == 0) {
@@ -749,7 +4128,7 @@ public:
                         if(it > value_start){
                             std::string_view value = std::string_view(value_start, it - value_start);
 
-                            if (ls_template_tag) {
+                            if (!Vanilla && ls_template_tag) {
                                 if (ls_template_attr_name == "id") {
                                     ls_template_id = std::string(value);
                                 }
@@ -762,12 +4141,7 @@ public:
                                 class_buffer.append(value);
                                 flag_appendToClass = false;
                             } else {
-                                char quote = value.find('\'') != std::string_view::npos ? '"' : '\'';
-
-                                output->append("=");
-                                output->append(1, quote);
-                                output->append(value);
-                                output->append(1, quote);
+                                pushAttributeValue(value);
                             }
                         }
 
@@ -793,10 +4167,18 @@ public:
 
                             // Handle inline values
 
-                            if (options.onInline) {
-                                options.onInline(*output, tagStack, rtrim(std::string_view(value_start, it - value_start)), userData);
+                            std::string_view value = rtrim(std::string_view(value_start, it - value_start));
+
+                            if (options.ssr && options.recordSlots && isDataPath(trim(value))) {
+                                output->append("<span data-reactive=\"").append(value).append("\">");
+                                recordSlot(SLOT_DATA, trim(value));
+                                output->append("</span>");
+                            } else if (Handlers::hasInline(options)) {
+                                Handlers::onInline(options, *output, tagStack, value, userData);
                             }
 
+                            after_block = false;
+
                         }
 
                         it += 1;
@@ -815,17 +4197,7 @@ public:
                         state = TEXT;
 
                         if (templateEnabled && !templatePath.empty() && cacheEntry) {
-                            std::string templateFile = rootPath + std::string(templatePath);
-
-                            try {
-                                HTMLParsingPosition originalPosition = storePosition();
-                                FileCache& templateCacheEntry = fromFile(templateFile, userData, rootPath);
-                                restorePosition(originalPosition);
-                                cacheEntry->templateLastModified = templateCacheEntry.lastModified;
-                                cacheEntry->templateCache = fileCache[templateCacheEntry.path];
-                            } catch (const std::filesystem::filesystem_error& e) {
-                                std::cerr << "Error accessing template file: " << e.what() << std::endl;
-                            }
+                            loadTemplate(rootPath + std::string(templatePath), userData, rootPath);
 
                             // if (cacheEntry->templateChunkSplit > 0) {
                             //     output->append(cacheEntry->content, 0, cacheEntry->templateChunkSplit);
@@ -837,6 +4209,19 @@ public:
                     }
                     break;
             }
+
+            if (suspended_at) break;
+        }
+
+        if (suspended_at) {
+            it = suspended_at;
+            suspended_at = nullptr;
+        }
+
+        if (partial) {
+            flushPending();
+            saveCarry();
+            return;
         }
 
         if(state == TEXT) {
@@ -848,33 +4233,45 @@ public:
         // }
     }
 
+    /**
+     * Parse (or find) the template of the entry being parsed and link it to the entry.
+     */
+    void loadTemplate(const std::string& templateFile, void* userData, const std::string& rootPath) {
+        try {
+            HTMLParsingPosition originalPosition = storePosition();
+            FileCache& templateCacheEntry = fromFile(templateFile, userData, rootPath);
+            restorePosition(originalPosition);
+            cacheEntry->templateRevision = templateCacheEntry.revision;
+            cacheEntry->templateCache = cache->find(templateCacheEntry.path);
+        } catch (const std::filesystem::filesystem_error& e) {
+            std::cerr << "Error accessing template file: " << e.what() << std::endl;
+        }
+    }
+
     /**
      * Inline a file into the current parsing location, treating it as if it were part of the current context.
      * Be cautious with this, as the state does not get reset.
      */
     void inlineFile(std::string filePath) {
-        std::ifstream file(filePath, std::ios::in | std::ios::binary | std::ios::ate);
-        if (!file.is_open()) {
-            throw std::runtime_error("Failed to open file: " + filePath);
-        }
+        std::shared_ptr<const SourceFile> source = SourceFile::load(filePath, options.maxFileSize);
 
-        std::streamsize size = file.tellg();
-        if (size > MAX_FILE_SIZE) {
-            throw std::runtime_error("File size exceeds maximum allowed size: " + filePath);
+        if (cacheEntry) {
+            // The entry has to be parsed again when the imported file changes
+            cacheEntry->dependencies.push_back(source->dependency);
+            cacheEntry->sources.push_back(source);
         }
 
-        file.seekg(0, std::ios::beg);
-        std::vector<char> buffer(size);
-        if (!file.read(buffer.data(), size)) {
-            throw std::runtime_error("Failed to read file: " + filePath);
-        }
-
-        std::string_view fileContent(buffer.data(), size);
+        std::string_view fileContent = source->view();
 
         HTMLParsingPosition pos = storePosition();
         HTMLParsingPosition newPos(fileContent.data(), fileContent.data() + fileContent.size(), fileContent.data(), output);
         restorePosition(newPos);
+
+        bool was_partial = partial;
+        partial = false;
         resume();
+        partial = was_partial;
+
         restorePosition(pos);
     }
 
@@ -885,6 +4282,15 @@ public:
     bool inside_head = false;
     bool templateEnabled = false;
 
+    // Cache used by fromFile (fileCache or planCache)
+    FileCacheStore* cache = &fileCache;
+
+    // Set when other contexts fill the same cache concurrently (see precompile)
+    PathLocks* locks = nullptr;
+
+    // Slots recorded outside of fromFile
+    std::vector<RenderSlot> slots;
+
     std::string* output;
 
 private:
@@ -896,6 +4302,81 @@ private:
 
     bool reset = true;
 
+    // Streaming state
+    static constexpr ptrdiff_t STREAM_LOOKAHEAD = 64;
+    bool streaming = false;
+    bool partial = false;
+    const char* suspended_at = nullptr;
+    std::string carry;
+    size_t carry_it = 0;
+    size_t carry_value = 0;
+    std::unordered_set<std::string> internedNames;
+
+    /**
+     * Write out the part of a pending text or raw element body that the rest of it can not change anymore, so it doesn't
+     * have to be carried over. Everything before it was already scanned (so it can't begin the closing tag), the split
+     * is made between two non-whitespace bytes so that trimming and collapsing whitespace give the same result in pieces.
+     * Bodies stay whole if onText is a custom handler, for styles minified in compact mode and from the first '@' of text with blocks.
+     */
+    void flushPending() {
+        if (ls_template_capture) return;
+
+        if (state == COMMENT) {
+            // Comments are dropped, only the possible end of one is needed
+            value_start = it;
+            return;
+        }
+
+        if ((state != TEXT && state != RAW_ELEMENT) || !Handlers::canSplitText(options)) return;
+        if (options.compact && state == RAW_ELEMENT && !tagStack.empty() && tagStack.top() == "style") return;
+
+        const char* limit = it;
+        if (Handlers::hasBlock(options) && state == TEXT && !options.vanilla) {
+            limit = std::find(value_start, it, '@');
+        }
+
+        if (limit >= chunk_end) return;
+
+        const char* split = limit;
+        while (split > value_start && (isSpace(split[-1]) || isSpace(*split))) --split;
+        if (split <= value_start) return;
+
+        const char* stopped_at = it;
+        it = split;
+        pushText(*output);
+        it = stopped_at;
+        value_start = split;
+    }
+
+    /**
+     * Keep the unfinished part of the current chunk (everything from the start of the pending token, or what flushPending
+     * left of a text or raw element body) plus one byte of history, so the next chunk can continue where this one stopped.
+     */
+    void saveCarry() {
+        const char* keep = std::min(value_start, it);
+        if (keep > buffer.data() && keep < chunk_end) --keep;
+
+        carry_it = it - keep;
+        carry_value = value_start - keep;
+
+        if (buffer.data() == carry.data()) {
+            carry.erase(0, keep - carry.data());
+        } else {
+            carry.assign(keep, chunk_end - keep);
+        }
+    }
+
+    /**
+     * Returns a view of the name that outlives the current buffer.
+     * Known tags map to the static tag table, other names are only copied while streaming.
+     */
+    std::string_view intern(std::string_view name) {
+        if (!streaming) return name;
+
+        if (const TagInfo* info = lookupTag(name)) return info->name;
+        return *internedNames.emplace(name).first;
+    }
+
     bool end_tag = false;
     bool space_broken = false;
     bool flag_appendToClass = false;
@@ -911,14 +4392,259 @@ private:
     std::shared_ptr<FileCache> cacheEntry = nullptr;
 
     void pushText(std::string& buffer) {
-        if(options.onText && !(it - value_start == 0)){
+        if(Handlers::hasText(options) && !(it - value_start == 0)){
             std::string_view text(value_start, it - value_start);
-            text = (!options.compact && !inside_head)? text: trim(text, true);
+
+            if (options.compact && state == TEXT && !inside_head) {
+                // Whitespace inside <pre> is content
+                if (pre_depth == 0) text = collapseWhitespace(text, buffer);
+            } else if (options.compact && state == RAW_ELEMENT && !tagStack.empty() && tagStack.top() == "style") {
+                text_buffer.clear();
+                css_minifier.minify(text, text_buffer);
+                text = text_buffer;
+            } else {
+                text = (!options.compact && !inside_head)? text: trim(text, true);
+            }
 
             if(text.size() > 0) {
-                options.onText(buffer, tagStack, text, userData);
+                if (!(Handlers::hasBlock(options) && state == TEXT && !options.vanilla && pushBlocks(buffer, text))) {
+                    Handlers::onText(options, buffer, tagStack, text, userData);
+                }
+                after_block = false;
+            }
+        }
+    }
+
+    /**
+     * Write text with its blocks going to onBlock. Returns false (having written nothing) if the text has no blocks
+     * or anything the native parser can't handle, then it goes to onText as usual.
+     */
+    bool pushBlocks(std::string& buffer, std::string_view text) {
+        if (text.find('@') == std::string_view::npos) return false;
+
+        // onBlock may inline a file (@import), which parses with this same context and reuses text_buffer,
+        // so the blocks and the collapsed text they point into have to belong to this call
+        std::string collapsed;
+        if (text.data() == text_buffer.data()) {
+            collapsed.assign(text);
+            text = collapsed;
+        }
+
+        std::vector<AtriumBlock> blocks;
+        if (!AtriumParser::parse(text, blocks) || blocks.empty()) return false;
+
+        const char* position = text.data();
+        for (const AtriumBlock& block : blocks) {
+            buffer.append(position, block.source.data() - position);
+            Handlers::onBlock(options, buffer, tagStack, block, userData);
+            position = block.source.data() + block.source.size();
+        }
+
+        buffer.append(position, text.data() + text.size() - position);
+        return true;
+    }
+
+    /*
+        Minification (options.compact)
+
+        Everything here runs as part of the normal pass, deciding on the already scanned token
+        or peeking at most one tag name ahead, so compact mode does not add another scan over the document.
+    */
+
+    bool after_block = true;                // Whitespace right after this position does not render
+    size_t pre_depth = 0;
+    const TagInfo* current_tag = nullptr;
+    size_t attribute_name_at = 0;
+    size_t attribute_name_end = std::string::npos;
+    std::string text_buffer;
+    CSSMinifier css_minifier;
+
+    // The last written end tag, if it may be left out depending on what follows it
+    const TagInfo* pending_end = nullptr;
+    size_t pending_end_at = 0;
+    size_t pending_end_slots = 0;
+
+    size_t slotCount() const {
+        return cacheEntry? cacheEntry->slots.size(): slots.size();
+    }
+
+    /**
+     * Whether the tag that starts at the current position (at '<') is a block element.
+     * Tags cut off by the end of the chunk count as inline, which only keeps a space that could have been dropped.
+     */
+    bool nextTagIsBlock() const {
+        if (it >= chunk_end || *it != '<') return false;
+
+        const char* name = it + 1;
+        if (name < chunk_end && *name == '/') ++name;
+
+        const char* name_end = name;
+        while (name_end < chunk_end && !hasCharClass(*name_end, CHAR_TAG_END)) {
+            if (static_cast<size_t>(name_end - name) > TAG_MAX_LENGTH) return false;
+            ++name_end;
+        }
+
+        if (name_end == chunk_end) return false;
+        return tagFlags(std::string_view(name, name_end - name)) & TAG_BLOCK;
+    }
+
+    /**
+     * Collapses whitespace the way the browser would render it: runs become a single space,
+     * and whitespace next to block elements is dropped. Returns a view into the text or into text_buffer.
+     */
+    std::string_view collapseWhitespace(std::string_view text, const std::string& written) {
+        bool leading = isSpace(text.front());
+        bool trailing = isSpace(text.back());
+
+        if (leading) leading = !after_block && !(written.size() > 0 && isSpace(written.back()));
+
+        size_t start = 0;
+        while (start < text.size() && isSpace(text[start])) ++start;
+
+        if (start == text.size()) {
+            return (leading && !nextTagIsBlock())? text.substr(0, 1): std::string_view();
+        }
+
+        size_t end = text.size();
+        while (isSpace(text[end - 1])) --end;
+
+        if (trailing) trailing = !nextTagIsBlock();
+
+        if (findCollapsibleSpace(text.data() + start, text.data() + end) == text.data() + end) {
+            // A single whitespace byte of any kind renders as a space, so the source can be used as is
+            return text.substr(start - leading, end - start + leading + trailing);
+        }
+
+        text_buffer.clear();
+        if (leading) text_buffer += ' ';
+
+        for (size_t i = start; i < end; ++i) {
+            if (!isSpace(text[i])) {
+                text_buffer += text[i];
+            } else if (!isSpace(text[i - 1])) {
+                text_buffer += ' ';
+            }
+        }
+
+        if (trailing) text_buffer += ' ';
+        return text_buffer;
+    }
+
+    /**
+     * Whether the end tag of an element may be left out when it is directly followed by
+     * the opening tag next, or by the end of its parent (next then being the parent).
+     */
+    static bool canOmitEndTag(const TagInfo* ended, const TagInfo* next, bool parentEnd) {
+        std::string_view name = next? next->name: std::string_view();
+
+        switch (ended->id) {
+            case 27: // p
+                if (!next) return false;
+                if (parentEnd) return name != "a" && name != "audio" && name != "video" && name != "noscript";
+                return next->flags & TAG_CLOSES_P;
+            case 33: // li
+                return parentEnd || name == "li";
+            case 77: // dt
+                return !parentEnd && (name == "dt" || name == "dd");
+            case 78: // dd
+                return parentEnd || name == "dt" || name == "dd";
+            case 44: // option
+                return parentEnd || name == "option" || name == "optgroup";
+            case 87: // optgroup
+                return parentEnd || name == "optgroup";
+            case 46: // thead
+                return !parentEnd && (name == "tbody" || name == "tfoot");
+            case 47: // tbody
+                return parentEnd || name == "tbody" || name == "tfoot";
+            case 84: // tfoot
+                return parentEnd;
+            case 48: // tr
+                return parentEnd || name == "tr";
+            case 49: // td
+            case 50: // th
+                return parentEnd || name == "td" || name == "th";
+        }
+        return false;
+    }
+
+    void minifyOpeningTag(const TagInfo* info) {
+        if (render_element) {
+            if (pending_end) omitPendingEndTag(info, false);
+            if (info && info->id == TAG_ID_PRE) ++pre_depth;
+        }
+
+        pending_end = nullptr;
+        after_block = info && (info->flags & TAG_BLOCK);
+        current_tag = info;
+    }
+
+    const TagInfo* minifyEndTag(std::string_view tag) {
+        const TagInfo* info = lookupTag(tag);
+
+        if (pending_end) omitPendingEndTag(info, true);
+        if (pre_depth > 0 && info && info->id == TAG_ID_PRE) --pre_depth;
+
+        pending_end = nullptr;
+        after_block = info && (info->flags & TAG_BLOCK);
+        return info;
+    }
+
+    /**
+     * Remembers an end tag that was just written, so the next tag can take it back (see omitPendingEndTag).
+     */
+    void deferEndTag(const TagInfo* info, size_t at) {
+        pending_end = info;
+        pending_end_at = at;
+        pending_end_slots = slotCount();
+    }
+
+    /**
+     * Takes back the pending end tag if nothing was written after it and what follows allows leaving it out.
+     */
+    void omitPendingEndTag(const TagInfo* next, bool parentEnd) {
+        if (!pending_end || !canOmitEndTag(pending_end, next, parentEnd)) return;
+
+        // Only if the tail is still exactly the end tag, a callback may have written anything
+        size_t length = pending_end->name.size() + 3;
+        if (output->size() != pending_end_at + length || slotCount() != pending_end_slots) return;
+        if (output->compare(pending_end_at, 2, "</") != 0 || output->compare(pending_end_at + 2, pending_end->name.size(), pending_end->name) != 0) return;
+
+        output->resize(pending_end_at);
+    }
+
+    /**
+     * Writes a quoted attribute value, in compact mode without quotes where the value allows it.
+     */
+    void pushQuoted(std::string_view value, char quote) {
+        if (options.compact && canOmitQuotes(value)) {
+            output->append(value);
+            return;
+        }
+
+        output->append(1, quote).append(value).append(1, quote);
+    }
+
+    /**
+     * Writes the value of the attribute that was just written.
+     * In compact mode boolean attributes stay without a value and default values are dropped with their name.
+     */
+    void pushAttributeValue(std::string_view value) {
+        if (options.compact && attribute_name_end == output->size()) {
+            std::string_view name(output->data() + attribute_name_at, attribute_name_end - attribute_name_at);
+
+            if (isDefaultAttribute(current_tag, name, value)) {
+                output->resize(attribute_name_at - 1);
+                return;
+            }
+
+            // Checking the value first keeps the table lookup off the common path
+            if ((value.empty() || equalsIgnoreCase(value, name)) && isBooleanAttribute(name)) {
+                return;
             }
         }
+
+        output->append("=");
+        pushQuoted(value, value.find('\'') != std::string_view::npos ? '"' : '\'');
     }
 
     char string_char = 0;
@@ -955,6 +4681,7 @@ private:
 
             if(current_template_scope == "template" && cacheEntry) {
                 cacheEntry->templateChunkSplit = output->size();
+                cacheEntry->templateChunkSplitSlot = cacheEntry->slots.size();
                 return;
             } else {
                 // TODO:
@@ -965,7 +4692,8 @@ private:
 
         if(options.buffer && render_element) {
             if(!class_buffer.empty()) {
-                output->append(" class=\"").append(class_buffer).append("\"");
+                output->append(" class=");
+                pushQuoted(class_buffer, '"');
                 class_buffer.clear();
             }
 
@@ -996,6 +4724,11 @@ private:
         return s.substr(start, end - start + 1);
     }
 
+    std::unique_lock<std::recursive_mutex> lockPath(const std::string& path) {
+        if (!locks) return std::unique_lock<std::recursive_mutex>();
+        return locks->lock(path);
+    }
+
     void resetState() {
         end_tag = false;
         space_broken = false;
@@ -1007,10 +4740,22 @@ private:
         string_char = 0;
         class_buffer.clear();
         body_attributes.clear();
-        tagStack = std::stack<std::string_view>();
+        while (!tagStack.empty()) tagStack.pop();
         template_scope = std::string_view();
+
+        streaming = false;
+        partial = false;
+        carry.clear();
+        carry_it = carry_value = 0;
+        internedNames.clear();
         inside_head = false;
 
+        after_block = true;
+        pre_depth = 0;
+        current_tag = nullptr;
+        attribute_name_end = std::string::npos;
+        pending_end = nullptr;
+
         ls_template_tag = false;
         ls_template_capture = false;
         ls_template_id.clear();
@@ -1032,226 +4777,125 @@ private:
         output = pos.output;
         cacheEntry = pos.cacheEntry;
     }
+};
 
-    std::string jsEscape(std::string_view s) {
-        std::string out;
-        out.reserve(s.size() + 8);
-        for (char c : s) {
-            switch (c) {
-                case '\\': out += "\\\\"; break;
-                case '"':  out += "\\\""; break;
-                case '\n': out += "\\n"; break;
-                case '\r': out += "\\r"; break;
-                case '\t': out += "\\t"; break;
-                default: out += c; break;
-            }
-        }
-        return out;
-    }
-
-    std::string normalizeDataExpr(std::string_view s) {
-        std::string_view t = trim(s);
-        if (t.empty()) return "data";
-        if (t.rfind("data.", 0) == 0 || t.find_first_of(".(") != std::string_view::npos) {
-            return std::string(t);
-        }
-        return "data." + std::string(t);
-    }
+// Runtime-configurable parser, see HTMLParserOptions
+using HTMLParsingContext = BasicHTMLParsingContext<RuntimeHandlers>;
 
-    std::string buildLsTemplateFunction(const std::string& id, std::string_view content) {
-        if (id.empty()) return "";
+// Buffer mode with the default handlers inlined
+using DefaultHTMLParsingContext = BasicHTMLParsingContext<DefaultHandlers>;
 
-        std::string js = "function " + id + "(data){\n";
-        int idx = 0;
-        std::string rootVar;
-        std::vector<std::string> stack;
-        std::vector<std::pair<std::string, std::string>> exports;
 
-        auto appendToParent = [&](const std::string& var) {
-            if (!stack.empty()) {
-                js += stack.back() + ".appendChild(" + var + ");\n";
-            } else if (rootVar.empty()) {
-                rootVar = var;
-            }
-        };
+/*
+    Precompilation
 
-        auto emitTextNode = [&](std::string_view txt) {
-            if (txt.empty()) return;
-            bool all_ws = true;
-            for (char c : txt) { if (!std::isspace(static_cast<unsigned char>(c))) { all_ws = false; break; } }
-            if (all_ws) return;
+    Walks application directories and parses every page (with its templates) into a cache on a pool of threads,
+    so the first request to each page doesn't have to. Every worker has its own context and passes it as userData,
+    same as the render plan context does.
+*/
 
-            std::string v = "e" + std::to_string(idx++);
-            js += "var " + v + "=document.createTextNode(\"" + jsEscape(txt) + "\");\n";
-            appendToParent(v);
-        };
+struct PrecompileStats {
+    size_t files = 0;
+    size_t bytes = 0;
+    double time = 0;
 
-        auto emitDynamic = [&](std::string_view expr) {
-            if (stack.empty()) return;
-            js += stack.back() + ".appendChild(LS.__dynamicInnerToNode(" + normalizeDataExpr(expr) + "));\n";
-        };
+    // File and error message for every page that failed to parse
+    std::vector<std::pair<std::string, std::string>> errors;
+};
 
-        auto emitReactive = [&](std::string_view expr) {
-            if (stack.empty()) return;
-            std::string v = "e" + std::to_string(idx++);
-            std::string name = std::string(trim(expr));
-            js += "var " + v + "=document.createElement(\"span\");\n";
-            js += "LS.Reactive.bindElement(" + v + ", \"" + jsEscape(name) + "\");\n";
-            appendToParent(v);
-        };
+static bool isPrecompiledExtension(const std::filesystem::path& path, const std::vector<std::string>& extensions) {
+    std::string extension = path.extension().string();
+    return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
+
+/**
+ * Parse all files with one of the given extensions under each root directory into the cache.
+ * Each root is also the root path templates are resolved against.
+ */
+inline PrecompileStats precompile(const std::vector<std::string>& rootDirs, HTMLParserOptions& options, FileCacheStore& cache, size_t threadCount = 0, bool templateEnabled = true, const std::vector<std::string>& extensions = { ".html", ".xw" }, PathLocks* sharedLocks = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+
+    struct PrecompileFile {
+        std::string path;
+        const std::string* rootPath;
+        size_t size;
+    };
 
-        auto emitText = [&](std::string_view txt) {
-            size_t p = 0;
-            while (p < txt.size()) {
-                size_t open = txt.find("{{", p);
-                if (open == std::string_view::npos) {
-                    emitTextNode(txt.substr(p));
-                    break;
-                }
-                bool hash = (open > 0 && txt[open - 1] == '#');
-                size_t plain_end = hash ? open - 1 : open;
-                if (plain_end > p) {
-                    emitTextNode(txt.substr(p, plain_end - p));
-                }
-                size_t close = txt.find("}}", open + 2);
-                if (close == std::string_view::npos) {
-                    emitTextNode(txt.substr(open));
-                    break;
-                }
-                std::string_view expr = txt.substr(open + 2, close - (open + 2));
-                if (hash) {
-                    emitDynamic(expr);
-                } else {
-                    emitReactive(expr);
-                }
-                p = close + 2;
-            }
-        };
+    std::vector<PrecompileFile> files;
+    PrecompileStats stats;
 
-        size_t i = 0;
-        while (i < content.size()) {
-            if (content[i] != '<') {
-                size_t next = content.find('<', i);
-                if (next == std::string_view::npos) next = content.size();
-                emitText(content.substr(i, next - i));
-                i = next;
-                continue;
-            }
+    for (const std::string& root : rootDirs) {
+        std::error_code error;
+        std::filesystem::recursive_directory_iterator iterator(root, std::filesystem::directory_options::skip_permission_denied, error), end;
 
-            if (content.compare(i, 4, "<!--") == 0) {
-                size_t end = content.find("-->", i + 4);
-                i = (end == std::string_view::npos) ? content.size() : end + 3;
-                continue;
-            }
+        for (; !error && iterator != end; iterator.increment(error)) {
+            const std::filesystem::directory_entry& entry = *iterator;
+            std::string name = entry.path().filename().string();
+            std::error_code entryError;
 
-            if (i + 1 < content.size() && content[i + 1] == '/') {
-                size_t end = content.find('>', i + 2);
-                if (end == std::string_view::npos) break;
-                if (!stack.empty()) stack.pop_back();
-                i = end + 1;
+            if (entry.is_directory(entryError)) {
+                // Hidden directories and dependencies don't contain pages
+                if (name[0] == '.' || name == "node_modules") iterator.disable_recursion_pending();
                 continue;
             }
 
-            size_t name_start = i + 1;
-            size_t name_end = name_start;
-            while (name_end < content.size() && !std::isspace(static_cast<unsigned char>(content[name_end])) && content[name_end] != '>' && content[name_end] != '/') {
-                ++name_end;
-            }
-            std::string tag = std::string(content.substr(name_start, name_end - name_start));
-
-            std::string idAttr;
-            std::string className;
-            std::string exportName;
-            std::vector<std::pair<std::string, std::string>> attrs;
-
-            size_t p = name_end;
-            bool selfClosing = false;
-
-            while (p < content.size()) {
-                while (p < content.size() && std::isspace(static_cast<unsigned char>(content[p]))) ++p;
-                if (p >= content.size()) break;
-                if (content[p] == '>') { ++p; break; }
-                if (content[p] == '/' && p + 1 < content.size() && content[p + 1] == '>') {
-                    selfClosing = true; p += 2; break;
-                }
+            if (!entry.is_regular_file(entryError) || !isPrecompiledExtension(entry.path(), extensions)) continue;
 
-                if (content[p] == '.' || content[p] == '#') {
-                    char kind = content[p++];
-                    size_t start = p;
-                    while (p < content.size() && !std::isspace(static_cast<unsigned char>(content[p])) && content[p] != '>' && content[p] != '/') ++p;
-                    std::string token = std::string(content.substr(start, p - start));
-                    if (kind == '.') {
-                        std::replace(token.begin(), token.end(), '.', ' ');
-                        if (!className.empty()) className += " ";
-                        className += token;
-                    } else {
-                        idAttr = token;
-                    }
-                    continue;
-                }
+            size_t size = entry.file_size(entryError);
+            if (entryError) continue;
 
-                size_t attr_start = p;
-                while (p < content.size() && !std::isspace(static_cast<unsigned char>(content[p])) && content[p] != '=' && content[p] != '>' && content[p] != '/') ++p;
-                std::string attrName = std::string(content.substr(attr_start, p - attr_start));
+            files.push_back({ entry.path().lexically_normal().string(), &root, size });
+        }
 
-                while (p < content.size() && std::isspace(static_cast<unsigned char>(content[p]))) ++p;
-                std::string attrValue;
-                if (p < content.size() && content[p] == '=') {
-                    ++p;
-                    while (p < content.size() && std::isspace(static_cast<unsigned char>(content[p]))) ++p;
-                    if (p < content.size() && (content[p] == '"' || content[p] == '\'')) {
-                        char q = content[p++];
-                        size_t vstart = p;
-                        while (p < content.size() && content[p] != q) ++p;
-                        attrValue = std::string(content.substr(vstart, p - vstart));
-                        if (p < content.size()) ++p;
-                    } else {
-                        size_t vstart = p;
-                        while (p < content.size() && !std::isspace(static_cast<unsigned char>(content[p])) && content[p] != '>' && content[p] != '/') ++p;
-                        attrValue = std::string(content.substr(vstart, p - vstart));
-                    }
-                }
+        if (error) {
+            stats.errors.emplace_back(root, error.message());
+        }
+    }
 
-                if (attrName == "class") {
-                    if (!className.empty()) className += " ";
-                    className += attrValue;
-                } else if (attrName == "id") {
-                    idAttr = attrValue;
-                } else if (attrName == "export") {
-                    exportName = attrValue;
-                } else if (!attrName.empty()) {
-                    attrs.emplace_back(attrName, attrValue);
-                }
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, files.size());
+
+    // Pass the locks everything else filling the cache uses, so requests can be served while this runs
+    PathLocks ownLocks;
+    PathLocks& locks = sharedLocks? *sharedLocks: ownLocks;
+    std::mutex statsMutex;
+    std::atomic<size_t> next { 0 };
+
+    auto work = [&]() {
+        HTMLParsingContext ctx(options);
+        ctx.cache = &cache;
+        ctx.locks = &locks;
+        ctx.templateEnabled = templateEnabled;
+
+        size_t index;
+        while ((index = next.fetch_add(1, std::memory_order_relaxed)) < files.size()) {
+            const PrecompileFile& file = files[index];
+
+            try {
+                ctx.compile(file.path, &ctx, *file.rootPath);
+
+                std::lock_guard<std::mutex> lock(statsMutex);
+                stats.files++;
+                stats.bytes += file.size;
+            } catch (const std::exception& e) {
+                std::lock_guard<std::mutex> lock(statsMutex);
+                stats.errors.emplace_back(file.path, e.what());
             }
+        }
+    };
 
-            std::string var = "e" + std::to_string(idx++);
-            js += "var " + var + "=document.createElement(\"" + jsEscape(tag) + "\");";
-            if (!idAttr.empty()) {
-                js += var + ".id=\"" + jsEscape(idAttr) + "\";";
-            }
-            if (!className.empty()) {
-                js += var + ".className=\"" + jsEscape(className) + "\";";
-            }
-            for (auto& kv : attrs) {
-                js += var + ".setAttribute(\"" + jsEscape(kv.first) + "\", \"" + jsEscape(kv.second) + "\");";
-            }
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++) {
+        threads.emplace_back(work);
+    }
 
-            appendToParent(var);
-            if (!exportName.empty()) {
-                exports.emplace_back(exportName, var);
-            }
-            if (!selfClosing) {
-                stack.push_back(var);
-            }
-            i = p;
-        }
+    // The calling thread does its share too
+    if (threadCount > 0) work();
 
-        if (rootVar.empty()) rootVar = "null";
-        js += "var __rootValue = " + rootVar + ";\nreturn { root: __rootValue";
-        for (auto& ex : exports) {
-            js += ", " + ex.first + ": " + ex.second;
-        }
-        js += " };\n}\n";
-        return js;
+    for (std::thread& thread : threads) {
+        thread.join();
     }
-};
\ No newline at end of file
+
+    stats.time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
@@ -13,6 +13,7 @@ let
     // Libraries
     fs = require("fs"),
     nodePath = require("path"),
+    crypto = require("node:crypto"),
     uws = require('uWebSockets.js'),
 
     parser, // Will be defined later
@@ -23,10 +24,17 @@ let
     { PathMatcher } = require("./router"),
     Units = require("./unit"),
 
-    { xxh3 } = require("@node-rs/xxhash");
-
     applications = new Map,
 
+    // Shared compression dictionaries by digest (see getDictionary)
+    dictionaries = new Map,
+
+    // Dictionaries evicted from the map above, still served while a cached page holds them (and advertises their URL)
+    evictedDictionaries = new Map,
+    evictedDictionaryCleanup = new FinalizationRegistry(digest => {
+        if (!evictedDictionaries.get(digest)?.deref()) evictedDictionaries.delete(digest);
+    }),
+
     // Backend object
     backend = require("akeno:backend")
 ;
@@ -454,6 +462,19 @@ const server = new class WebServer extends Units.Module {
 
             let url = req.path;
 
+            // Shared compression dictionaries, their URL never changes for the same content
+            if (url.startsWith(DICTIONARY_PATH)) {
+                const dictionary = findDictionary(url.slice(DICTIONARY_PATH.length));
+                if (!dictionary) return backend.helper.sendErrorPage(req, res, "404");
+
+                backend.helper.send(req, res, dictionary.buffer, {
+                    "Content-Type": "application/octet-stream",
+                    "Cache-Control": "public, max-age=31536000, immutable",
+                    "Use-As-Dictionary": `match="/*", match-dest=("document")`
+                });
+                return;
+            }
+
             // Path attributes
             if (app._hasAttribs && app.pathMatcher) {
                 let attributes = app.pathMatcher.match(url);
@@ -513,6 +534,9 @@ const server = new class WebServer extends Units.Module {
 
             // We need to do this upfront even if not used, because we can't access the request after an await
             const ACCEPTS_ENCODING = req.getHeader("accept-encoding") || "";
+            req.ifNoneMatch = req.getHeader("if-none-match");
+            req.acceptEncoding = ACCEPTS_ENCODING;
+            req.availableDictionary = req.getHeader("available-dictionary");
 
             let file = resolvedPath.full;
 
@@ -577,7 +601,25 @@ const server = new class WebServer extends Units.Module {
                     const directory = nodePath.dirname(resolvedPath.relative);
 
                     parserContext.data = { url, directory, path: app.path, root: app.root, file, app, secure: req.secure };
-                    content = parser.fromFile(file, parserContext, true);
+                    parserContext.blockState = "";
+                    // Native builds without fromFileAsync only parse on the main thread
+                    content = parser.fromFileAsync? await parser.fromFileAsync(file, parserContext, true): parser.fromFile(file, parserContext, true);
+
+                    // With {{ }} values rendered from the request data (web.ssr), the output is only valid for this request.
+                    // The plan stays cached natively, so later requests only render it again.
+                    if (content && content.perRequest) {
+                        if (cacheEntry) server.fileServer.cache.delete(file);
+
+                        backend.helper.sendCompressed(req, res, content, "text/html", {
+                            "Content-Type": "text/html; charset=utf-8",
+                            "Cache-Control": "private, no-cache",
+                            "Vary": "Accept-Encoding, Akeno-Content-Only",
+                            "X-Content-Type-Options": "nosniff"
+                        }, errorCode, suggestedAlg);
+                        return;
+                    }
+
+                    if (content) content.dictionary = getDictionary(file);
                 }
 
                 if (cacheEntry) {
@@ -719,6 +761,23 @@ const server = new class WebServer extends Units.Module {
         }
 
         this.log(`${skip_config_refresh ? "Loaded" : "Reloaded"} ${locations.length} web application${locations.length !== 1 ? "s" : ""} in ${(performance.now() - start).toFixed(2)}ms`);
+
+        // Parse all pages ahead of time, so the first request to each page doesn't pay for it
+        if (webConfig.get("precompile", Boolean, true) && parser?.precompile) {
+            const paths = [...applications.values()].filter(app => app.enabled).map(app => app.path);
+
+            try {
+                const stats = await parser.precompile(paths);
+
+                for (const error of stats.errors) {
+                    this.warn(`Failed to precompile "${error.file}": ${error.message}`);
+                }
+
+                this.log(`Precompiled ${stats.files} page${stats.files !== 1 ? "s" : ""} (${(stats.bytes / 1024).toFixed(1)} KiB) in ${stats.time.toFixed(2)}ms`);
+            } catch (error) {
+                this.warn("Failed to precompile pages: ", error);
+            }
+        }
     }
 
     onLoad() {
@@ -730,7 +789,29 @@ const server = new class WebServer extends Units.Module {
             EXTRAGON_CDN: backend.config.getBlock("web").get("extragon_cdn_url", String) || backend.mode === backend.modes.DEVELOPMENT ? `https://cdn.extragon.localhost` : `https://cdn.extragon.cloud`
         };
 
-        initParser(header);
+        // Largest file the parser will load, in bytes
+        const maxFileSize = backend.config.getBlock("web").get("maxFileSize", Number, 10 * 1024 * 1024);
+
+        // Compile <ls::template> elements into cloned <template> factories instead of per-node DOM calls
+        const cloneTemplates = backend.config.getBlock("web").get("cloneTemplates", Boolean, false);
+
+        // Render {{ path }} values from the request data on the server, instead of leaving empty markers for the client
+        const ssr = backend.config.getBlock("web").get("ssr", Boolean, false);
+
+        initParser(header, maxFileSize, cloneTemplates, ssr);
+
+        // Memory budget of the native page cache, in bytes
+        const cacheBudget = backend.config.getBlock("web").get("cacheBudget", Number, null);
+        if (cacheBudget !== null && cacheBudget >= 0 && backend.native.setCacheBudget) {
+            backend.native.setCacheBudget(cacheBudget);
+        }
+
+        // Keep parsed pages on disk, so restarts don't have to parse everything again
+        if (backend.config.getBlock("web").get("diskCache", Boolean, true) && backend.native.setDiskCache) {
+            if (!backend.native.setDiskCache(backend.path + "/db/cache/parser")) {
+                this.warn("Could not open the parser disk cache, pages will be parsed on every start.");
+            }
+        }
 
         backend.exposeToDebugger("parser", parser);
         this.reload(null, true);
@@ -870,6 +951,75 @@ function checkSupportedBrowser(userAgent, properties) {
 }
 
 
+const DICTIONARY_PATH = "/.akeno/dictionary/";
+const MAX_DICTIONARIES = 256;
+
+/**
+ * Shared compression dictionary for a page - the template it was composed with, so navigations within an app
+ * only send what differs from the template. Returns null if the page has no template or dictionaries are not supported.
+ * @param {string} file - The page.
+ * @returns {{ buffer: Buffer, sha256: Buffer, hash: string, url: string }|null}
+ */
+function getDictionary(file) {
+    if (!parser.dictionary || !backend.compression.enabled || (!backend.compression.dictionarySupported.brotli && !backend.compression.dictionarySupported.zstd)) return null;
+
+    const buffer = parser.dictionary(file);
+    if (!buffer || buffer.length < backend.constants.MIN_COMPRESSION_SIZE) return null;
+
+    let dictionary = findDictionary(buffer.digest);
+    if (!dictionary) {
+        const sha256 = crypto.createHash("sha256").update(buffer).digest();
+        dictionary = { buffer, sha256, hash: `:${sha256.toString("base64")}:`, url: DICTIONARY_PATH + buffer.digest };
+    }
+
+    if (!dictionaries.has(buffer.digest)) {
+        evictedDictionaries.delete(buffer.digest);
+        dictionaries.set(buffer.digest, dictionary);
+
+        // Pages already sent may still point clients at the oldest one, so it stays reachable for as long as a
+        // cached page holds it - it is only gone once every page using it was re-rendered or dropped from the cache
+        if (dictionaries.size > MAX_DICTIONARIES) {
+            const [digest, evicted] = dictionaries.entries().next().value;
+            dictionaries.delete(digest);
+            evictedDictionaries.set(digest, new WeakRef(evicted));
+            evictedDictionaryCleanup.register(evicted, digest);
+        }
+    }
+
+    return dictionary;
+}
+
+/**
+ * Dictionary by digest, including evicted ones that are still in use.
+ * @param {string} digest - The digest (the last part of its URL).
+ * @returns {{ buffer: Buffer, sha256: Buffer, hash: string, url: string }|undefined}
+ */
+function findDictionary(digest) {
+    return dictionaries.get(digest) || evictedDictionaries.get(digest)?.deref();
+}
+
+/**
+ * Escapes text for HTML (& < > " '), natively where the native module provides it.
+ * @param {Buffer|string} content - The text.
+ * @returns {Buffer|string} The escaped text.
+ */
+function escapeHTML(content) {
+    if (backend.native.escapeHTML) return backend.native.escapeHTML(content);
+
+    // Same output as the native escaper
+    return content.toString().replace(/&/g, '&amp;').replace(/'/g, '&#39;').replace(/"/g, '&quot;').replace(/</g, '&lt;').replace(/>/g, '&gt;');
+}
+
+/**
+ * Flags that blocks leave for the ones after them on the same page (LS version, whether bundles were linked, preconnects).
+ * They live in the blockState string of the context rather than in this.data, so the native parser can memoize blocks by it.
+ * @param {object} context - The parser context.
+ * @returns {object} The flags.
+ */
+function getBlockState(context) {
+    return context.blockState? JSON.parse(context.blockState): {};
+}
+
 const ls_path = backend.path + "/addons/cdn/ls";
 const latest_ls_version = fs.existsSync(ls_path + "/version") ? fs.readFileSync(ls_path + "/version", "utf8").trim() : "5.1.0";
 
@@ -906,41 +1056,79 @@ const ls_components = {
     ]
 };
 
-function initParser(header) {
+function initParser(header, maxFileSize, cloneTemplates = false, ssr = false) {
+    function onText(text, parent, context) {
+        if (!text || text.length === 0) return;
+        
+        // Inline script compression
+        // TODO: Handle script type
+        if(parent === "script") {
+            if(!backend.compression.codeEnabled) {
+                return true;
+            }
+
+            return backend.helper.ContentProcessor.buildSync({ content: text, ext: "js", targets: backend.esbuildTargets, asBuffer: false, filePath: this?.data?.path, app: this?.data?.app }).result;
+
+            // return backend.compression.code(text, backend.compression.format.JS);
+        }
+
+        // Inline styles never get here, they are minified natively in compact mode
+
+        // Blocks are normally parsed natively (see the blocks option), only text the native parser
+        // wasn't sure about gets here - parse it with Atrium, text gets sent back to C++, blocks get handled via onBlock
+        parse(text, context);
+    }
+
     parser = new backend.native.parser({
         header,
+        maxFileSize,
         buffer: true,
         compact: backend.compression.codeEnabled,
+        cloneTemplates,
+        ssr,
+        blocks: true,
 
-        onText(text, parent, context) {
-            if (!text || text.length === 0) return;
-            
-            // Inline script compression
-            // TODO: Handle script type
-            if(parent === "script") {
-                if(!backend.compression.codeEnabled) {
-                    return true;
-                }
-
-                return backend.helper.ContentProcessor.buildSync({ content: text, ext: "js", targets: backend.esbuildTargets, asBuffer: false, filePath: this?.data?.path, app: this?.data?.app }).result;
-
-                // return backend.compression.code(text, backend.compression.format.JS);
-            }
-
-            // Inline style compression
-            if (parent === "style") {
-                if(!backend.compression.codeEnabled) {
-                    return true;
-                }
+        // Output of other blocks is memoized by their content, parent tag and this.blockState.
+        // These read or change other per-page state (this.data, body attributes, files on disk), so they always run.
+        volatileBlocks: ["page", "import", "importRaw", "file-scope-key"],
 
-                // TODO: Idea; could have a special attribute to support inline scss (editor won't like it though)
-                return backend.helper.ContentProcessor.buildSync({ content: text, ext: "css", targets: backend.esbuildTargets, asBuffer: false, filePath: this?.data?.path, app: this?.data?.app }).result;
+        onText,
 
-                // return backend.compression.code(text, backend.compression.format.CSS);
+        /**
+         * Handles every slot of a page in a single call.
+         * events holds 5 numbers per slot: type, text offset, text length, parent offset, parent length (offsets into source).
+         * Output can't be written to the context during the batch, so each slot gets a small context that collects it instead.
+         */
+        onBatch(source, events, context) {
+            const results = new Array(events.length / 5);
+
+            let output = "", parent = null;
+            const slotContext = {
+                data: context.data,
+                embedded: context.embedded,
+                strict: context.strict,
+                onBlock: context.onBlock,
+
+                write(chunk) { output += chunk },
+                onText(chunk) { output += chunk },
+                getTagName() { return parent },
+                setBodyAttributes(attributes) { context.setBodyAttributes(attributes) },
+                import(path) { output += context.import(path) }
+            };
+
+            for (let i = 0, j = 0; j < events.length; i++, j += 5) {
+                // Only text slots are handled here
+                if (events[j] !== 0) continue;
+
+                const text = source.slice(events[j + 1], events[j + 1] + events[j + 2]);
+                parent = events[j + 4] ? source.slice(events[j + 3], events[j + 3] + events[j + 4]) : null;
+                output = "";
+
+                const result = onText.call(slotContext, text, parent, slotContext);
+                results[i] = output + (result === true ? text : typeof result === "string" || Buffer.isBuffer(result) ? result.toString() : "");
             }
 
-            // Parse with Atrium, text gets sent back to C++, blocks get handled via onBlock
-            parse(text, context);
+            return results;
         },
 
         // onEnd(context) {
@@ -955,6 +1143,11 @@ function initParser(header) {
 
         switch (block.name) {
             case "use":
+                const blockState = getBlockState(this);
+
+                // Output that depends on files on disk or warns is not memoized (see volatileBlocks)
+                let memoize = true;
+
                 // if(parent !== "head") {
                 //     server.warn("Error in app " + this.data.path + ": @use can only be used in <head>.");
                 //     break
@@ -994,17 +1187,18 @@ function initParser(header) {
 
                     if (attrib === "ls" || attrib.startsWith("ls.")) {
                         if (!version) {
-                            if (this.data.ls_version) {
-                                version = this.data.ls_version;
+                            if (blockState.ls_version) {
+                                version = blockState.ls_version;
                             } else {
                                 console.error(`Error in app "${this.data.path}": No version was specified for LS in your app. This is no longer supported - you must specify a version, for example ${attrib}:${latest_ls_version}. To enforce the latest version, use ${attrib}:latest`);
+                                memoize = false;
                                 break;
                             }
                         }
 
                         if (version === "latest") version = latest_ls_version;
 
-                        this.data.ls_version = version;
+                        blockState.ls_version = version;
 
                         const is_merged = attrib === "ls";
 
@@ -1023,27 +1217,27 @@ function initParser(header) {
                         
                         if (is_merged || attrib === "ls.css" || singularCSSComponent) {
                             const cssComponents = is_merged ? components.filter(value => ls_components.css.includes(value)) : components;
-                            const useSingular = cssComponents.length === 1 && (this.data.using_ls_css || singularCSSComponent);
+                            const useSingular = cssComponents.length === 1 && (blockState.using_ls_css || singularCSSComponent);
                             components_string = cssComponents.join();
 
                             if (components_string.length !== 0) {
-                                this.write(`<link rel=stylesheet href="${server.etc.EXTRAGON_CDN}/ls/${version}/${(components_string && !useSingular) ? components_string + "/" : ""}${useSingular? components_string: this.data.using_ls_css ? "bundle" : "ls"}.${this.data.compress ? "min." : ""}css">`);
-                                this.data.using_ls_css = true;
+                                this.write(`<link rel=stylesheet href="${server.etc.EXTRAGON_CDN}/ls/${version}/${(components_string && !useSingular) ? components_string + "/" : ""}${useSingular? components_string: blockState.using_ls_css ? "bundle" : "ls"}.${blockState.compress ? "min." : ""}css">`);
+                                blockState.using_ls_css = true;
                             }
                         }
 
                         if (is_merged || attrib === "ls.js" || singularJSComponent) {
                             const jsComponents = is_merged ? components.filter(value => ls_components.js.includes(value)) : components;
-                            const useSingular = jsComponents.length === 1 && (this.data.using_ls_js || singularJSComponent);
+                            const useSingular = jsComponents.length === 1 && (blockState.using_ls_js || singularJSComponent);
                             components_string = jsComponents.join();
 
                             if (components_string.length !== 0) {
-                                this.write(`<script src="${server.etc.EXTRAGON_CDN}/ls/${version}/${(components_string && !useSingular) ? components_string + "/" : ""}${useSingular? components_string: this.data.using_ls_js ? "bundle" : "ls"}.${this.data.compress ? "min." : ""}js"${scriptAttributes}></script>`);
-                                this.data.using_ls_js = true;
+                                this.write(`<script src="${server.etc.EXTRAGON_CDN}/ls/${version}/${(components_string && !useSingular) ? components_string + "/" : ""}${useSingular? components_string: blockState.using_ls_js ? "bundle" : "ls"}.${blockState.compress ? "min." : ""}js"${scriptAttributes}></script>`);
+                                blockState.using_ls_js = true;
                             }
                         }
 
-                        this.data.using_ls = true;
+                        blockState.using_ls = true;
                         continue;
                     }
 
@@ -1085,15 +1279,17 @@ function initParser(header) {
                             break;
 
                         case "google-fonts":
-                            if (!this.data.flag_google_fonts_preconnect) {
+                            if (!blockState.flag_google_fonts_preconnect) {
                                 this.write(`<link rel=preconnect href="https://fonts.googleapis.com"><link rel=preconnect href="https://fonts.gstatic.com" crossorigin>`)
-                                this.data.flag_google_fonts_preconnect = true;
+                                blockState.flag_google_fonts_preconnect = true;
                             }
 
                             if (components.length > 0) this.write(`<link rel=stylesheet href="https://fonts.googleapis.com/css2?${components.map(font => "family=" + font.replaceAll(" ", "+")).join("&")}&display=swap">`)
                             break;
 
                         default:
+                            memoize = false;
+
                             if (attrib.includes("/")) {
                                 if (attrib.startsWith("http")) {
                                     server.warn("Error in app " + this.data.path + ": @use does not allow direct URL imports (\"" + attrib + "\") - please define a custom @source or use a different way to import your content.");
@@ -1131,7 +1327,9 @@ function initParser(header) {
                             }
                     }
                 }
-                break;
+
+                this.blockState = JSON.stringify(blockState);
+                return memoize;
 
             case "page":
                 if (parent !== "head") {
@@ -1185,9 +1383,10 @@ function initParser(header) {
                     }
                 }
 
-                let bodyAttributes = this.data.using_ls_css ? "ls" : "";
+                const using_ls_css = getBlockState(this).using_ls_css;
+                let bodyAttributes = using_ls_css ? "ls" : "";
 
-                if (this.data.using_ls_css) {
+                if (using_ls_css) {
                     if (block.properties.theme) {
                         bodyAttributes += ` ls-theme="${block.properties.theme}"`;
                     }
@@ -1202,7 +1401,7 @@ function initParser(header) {
                 }
 
                 if (block.properties.font) {
-                    bodyAttributes += this.data.using_ls_css ? ` style="--font:${block.properties.font}"` : ` style="font-family:${block.properties.font}"`;
+                    bodyAttributes += using_ls_css ? ` style="--font:${block.properties.font}"` : ` style="font-family:${block.properties.font}"`;
                 }
 
                 if (block.properties.favicon) {
@@ -1248,8 +1447,8 @@ function initParser(header) {
                     const path = this.data.app.resolvePath(item, this.data.directory).full;
 
                     try {
-                        let content = fs.readFileSync(path, "utf8");
-                        this.write(!!block.properties.escape ? content.replace(/'/g, '&#39;').replace(/"/g, '&quot;').replace(/</g, '&lt;').replace(/>/g, '&gt;') : content);
+                        const content = fs.readFileSync(path);
+                        this.write(!!block.properties.escape ? escapeHTML(content) : content);
                     } catch (error) {
                         this.data.app.warn("Failed to import (raw): " + item + " (" + path + ")", error);
                     }
@@ -1258,7 +1457,7 @@ function initParser(header) {
 
             case "file-scope-key":
                 if (!this.data.file) break;
-                this.write(xxh3.xxh64(nodePath.dirname(this.data.file)).toString(16));
+                this.write(backend.helper.hash(nodePath.dirname(this.data.file)));
                 break;
 
             case "print":